@@ -2,22 +2,43 @@
 #ifndef UNIVERSAL_PRESENTATION_H_
 #define UNIVERSAL_PRESENTATION_H_
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <bitset>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <deque>
 #include <forward_list>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <queue>
 #include <set>
 #include <sstream>
 #include <stack>
+#include <string>
 #include <string_view>
+#include <tuple>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -54,6 +75,70 @@ auto constexpr ostreamable_v<
     T,
     std::void_t<decltype(std::cout << std::declval<T>())>> = true;
 
+template <typename T, typename = void>
+auto constexpr iterable_v = false;
+template <typename T>
+auto constexpr iterable_v<
+    T,
+    std::void_t<decltype(std::begin(std::declval<const T &>())),
+                decltype(std::end(std::declval<const T &>()))>> = true;
+
+template <typename T, typename = void>
+auto constexpr sized_v = false;
+template <typename T>
+auto constexpr sized_v<
+    T,
+    std::void_t<decltype(std::size(std::declval<const T &>()))>> = true;
+
+template <typename T, typename = void>
+auto constexpr bidirectional_v = false;
+template <typename T>
+auto constexpr bidirectional_v<
+    T,
+    std::void_t<decltype(std::rbegin(std::declval<const T &>()))>> = true;
+
+template <typename T, typename = void>
+auto constexpr associative_v = false;
+template <typename T>
+auto constexpr associative_v<T, std::void_t<typename T::key_type>> = true;
+
+template <typename T, typename = void>
+auto constexpr ordered_assoc_v = false;
+template <typename T>
+auto constexpr ordered_assoc_v<T, std::void_t<typename T::key_compare>> =
+    true;
+
+template <typename T>
+auto constexpr random_access_v = std::is_base_of_v<
+    std::random_access_iterator_tag,
+    typename std::iterator_traits<decltype(std::begin(
+        std::declval<const T &>()))>::iterator_category>;
+
+template <typename T, typename = void>
+auto constexpr unordered_assoc_v = false;
+template <typename T>
+auto constexpr unordered_assoc_v<T, std::void_t<typename T::hasher>> = true;
+
+template <typename T, typename = void>
+auto constexpr map_like_v = false;
+template <typename T>
+auto constexpr map_like_v<T, std::void_t<typename T::mapped_type>> = true;
+
+template <typename T, typename = void>
+auto constexpr less_comparable_v = false;
+template <typename T>
+auto constexpr less_comparable_v<
+    T,
+    std::void_t<decltype(std::declval<const T &>() <
+                         std::declval<const T &>())>> = true;
+
+template <typename T>
+auto constexpr string_like_v = false;
+template <typename C, typename Traits, typename Alloc>
+auto constexpr string_like_v<std::basic_string<C, Traits, Alloc>> = true;
+template <typename C, typename Traits>
+auto constexpr string_like_v<std::basic_string_view<C, Traits>> = true;
+
 namespace names
 {
 // Checks magic_enum compiler compatibility.
@@ -72,6 +157,7 @@ inline std::string_view pretty_name(std::string_view name) noexcept
         if (name[i - 1] == '=')
         {
             name.remove_prefix(i);
+            break;
         }
     }
     if (name.size() > 0 && name[0] == ' ')
@@ -230,6 +316,10 @@ struct pre_ctx
     ssize_t depth{std::numeric_limits<decltype(depth)>::max()};
     bool human{false};
     bool quote_string{true};
+    // print unordered containers sorted by key, see namespace ordered
+    bool sorted{false};
+    // > 0: multi-line layout targeting this width, see namespace layout
+    ssize_t width{0};
 };
 
 template <typename T>
@@ -277,7 +367,10 @@ private:
 };
 
 // Fallback cout of pre_impl<T> to cout of T itself.
-template <typename T, std::enable_if_t<ostreamable_v<T>, bool> = true>
+// C-style arrays are cout-able as a pointer, print them as ranges instead.
+template <typename T,
+          std::enable_if_t<ostreamable_v<T> && !std::is_array_v<T>, bool> =
+              true>
 inline std::ostream &operator<<(std::ostream &os, const pre_impl<T> &t)
 {
     os << t.inner();
@@ -363,6 +456,330 @@ auto constexpr universally_presentable_v<
     std::void_t<decltype(std::cout << util::pre_impl(std::declval<T>()))>> =
     true;
 
+// Per-call-site cost accounting, see pre_stats_dump. Compiled in only with
+// UP_STATS defined.
+namespace stats
+{
+#ifdef UP_STATS
+// Elements printed by the range printers on this thread
+inline thread_local uint64_t tl_elements = 0;
+inline void element()
+{
+    ++tl_elements;
+}
+#else
+inline void element()
+{
+}
+#endif
+}  // namespace stats
+
+// A streambuf that can emit large strings by reference instead of copying
+// them, see fd_sink. Its ostream stores it in pword(gather_buf::index()),
+// so plain streams pay one pword lookup and no dynamic_cast.
+class gather_buf : public std::streambuf
+{
+public:
+    static int index()
+    {
+        static const int i = std::ios_base::xalloc();
+        return i;
+    }
+    // Reference [data, data + size) in the output, false to copy it instead
+    virtual bool gather(const char *data, size_t size) = 0;
+};
+
+// Width-aware multi-line layout (Oppen's algorithm).
+// Containers and tuples emit groups: "[" begin break ... "," break ... end
+// "]". A group that fits in the remaining width is printed on one line.
+// Otherwise each break becomes a newline with indentation.
+// The layout_buf only buffers the tokens of undecided groups, at most width
+// characters, so the layout is linear and never formats anything twice.
+namespace layout
+{
+constexpr static size_t kIndent = 4;
+
+class layout_buf : public std::streambuf
+{
+public:
+    layout_buf(std::streambuf *out, ssize_t width) : out_(out), width_(width)
+    {
+    }
+    ~layout_buf()
+    {
+        finish();
+    }
+    void begin()
+    {
+        dq_.push_back({pushed_, pos_});
+        push({token::kBegin, {}, 0, 0, false});
+    }
+    // flat: the width when not broken, offset: the indentation when broken
+    void brk(size_t flat, size_t offset)
+    {
+        if (dq_.empty())
+        {
+            process({token::kBreak, {}, flat, offset, false});
+            return;
+        }
+        pos_ += flat;
+        push({token::kBreak, {}, flat, offset, false});
+        check();
+    }
+    void end()
+    {
+        if (dq_.empty())
+        {
+            process({token::kEnd, {}, 0, 0, false});
+            return;
+        }
+        // the innermost group ends before overflow, record its size.
+        // Whether it fits is known once its start column is.
+        auto &g = dq_.back();
+        pending_[g.seq - popped_].flat = pos_ - g.pos;
+        dq_.pop_back();
+        push({token::kEnd, {}, 0, 0, false});
+        if (dq_.empty())
+        {
+            flush(pushed_);
+        }
+    }
+    void finish()
+    {
+        dq_.clear();
+        flush(pushed_);
+    }
+    // The bytes streamed in so far, before line breaks and indentation
+    size_t written() const
+    {
+        return written_;
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            char c = traits_type::to_char_type(ch);
+            text(&c, 1);
+        }
+        return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        text(s, n);
+        return n;
+    }
+
+private:
+    struct token
+    {
+        enum Kind
+        {
+            kText,
+            kBegin,
+            kEnd,
+            kBreak
+        };
+        Kind kind;
+        std::string text;
+        size_t flat;    // kBreak: width if flat, kBegin: size of the group
+        size_t offset;  // kBreak: indentation if broken
+        bool broken;    // kBegin: overflowed before its end
+    };
+    struct group
+    {
+        size_t seq;  // of the kBegin token
+        size_t pos;  // stream position at begin
+    };
+    struct frame
+    {
+        bool broken;
+        size_t base;
+    };
+
+    void text(const char *s, size_t n)
+    {
+        written_ += n;
+        if (dq_.empty())
+        {
+            write(s, n);
+            return;
+        }
+        pos_ += n;
+        if (!pending_.empty() && pending_.back().kind == token::kText)
+        {
+            pending_.back().text.append(s, n);
+        }
+        else
+        {
+            push({token::kText, std::string(s, n), 0, 0, false});
+        }
+        check();
+    }
+    void push(token &&t)
+    {
+        pending_.push_back(std::move(t));
+        pushed_++;
+    }
+    // the outermost undecided group does not fit: break it
+    void check()
+    {
+        while (!dq_.empty() && ssize_t(pos_ - dq_.front().pos) >
+                                   width_ - ssize_t(col_))
+        {
+            pending_[dq_.front().seq - popped_].broken = true;
+            dq_.pop_front();
+            flush(dq_.empty() ? pushed_ : dq_.front().seq);
+        }
+    }
+    void flush(size_t until_seq)
+    {
+        while (popped_ < until_seq)
+        {
+            process(pending_.front());
+            pending_.pop_front();
+            popped_++;
+        }
+    }
+    void process(const token &t)
+    {
+        switch (t.kind)
+        {
+        case token::kText:
+            write(t.text.data(), t.text.size());
+            break;
+        case token::kBegin:
+            frames_.push_back(
+                {t.broken || ssize_t(t.flat) > width_ - ssize_t(col_),
+                 line_indent_});
+            break;
+        case token::kEnd:
+            if (!frames_.empty())
+            {
+                frames_.pop_back();
+            }
+            break;
+        case token::kBreak:
+            if (!frames_.empty() && frames_.back().broken)
+            {
+                line_indent_ = frames_.back().base + t.offset;
+                out_->sputc('\n');
+                for (size_t i = 0; i < line_indent_; ++i)
+                {
+                    out_->sputc(' ');
+                }
+                col_ = line_indent_;
+            }
+            else
+            {
+                for (size_t i = 0; i < t.flat; ++i)
+                {
+                    out_->sputc(' ');
+                }
+                col_ += t.flat;
+            }
+            break;
+        }
+    }
+    void write(const char *s, size_t n)
+    {
+        out_->sputn(s, n);
+        for (size_t i = 0; i < n; ++i)
+        {
+            col_ = s[i] == '\n' ? 0 : col_ + 1;
+        }
+    }
+
+    std::streambuf *out_;
+    ssize_t width_;
+    size_t col_{0};
+    size_t line_indent_{0};
+    size_t pos_{0};
+    size_t pushed_{0};
+    size_t popped_{0};
+    size_t written_{0};
+    std::deque<token> pending_;
+    std::deque<group> dq_;
+    std::vector<frame> frames_;
+};
+
+inline layout_buf *get(std::ostream &os, const pre_ctx &ctx)
+{
+    if (ctx.width <= 0)
+    {
+        return nullptr;
+    }
+    return dynamic_cast<layout_buf *>(os.rdbuf());
+}
+
+// true if ctx asks for layout, but os is not laid out yet
+inline bool unwrapped(std::ostream &os, const pre_ctx &ctx)
+{
+    return ctx.width > 0 && !dynamic_cast<layout_buf *>(os.rdbuf());
+}
+
+// A std::ostream laying out into os
+class wrapper
+{
+public:
+    wrapper(std::ostream &os, const pre_ctx &ctx)
+        : buf_(os.rdbuf(), ctx.width), os_(&buf_)
+    {
+        os_.copyfmt(os);
+        // strings go through the layout, not around it into os's sink
+        os_.pword(gather_buf::index()) = nullptr;
+    }
+    std::ostream &os()
+    {
+        return os_;
+    }
+
+private:
+    layout_buf buf_;
+    std::ostream os_;
+};
+
+inline void open(std::ostream &os, const pre_ctx &ctx, char lb)
+{
+    auto *buf = get(os, ctx);
+    if (buf)
+    {
+        buf->begin();
+    }
+    os << lb;
+    if (buf)
+    {
+        buf->brk(0, kIndent);
+    }
+}
+inline void sep(std::ostream &os, const pre_ctx &ctx, char sep)
+{
+    os << sep;
+    if (auto *buf = get(os, ctx))
+    {
+        buf->brk(1, kIndent);
+    }
+    else
+    {
+        os << ' ';
+    }
+}
+inline void close(std::ostream &os, const pre_ctx &ctx, char rb)
+{
+    auto *buf = get(os, ctx);
+    if (buf)
+    {
+        buf->brk(0, 0);
+    }
+    os << rb;
+    if (buf)
+    {
+        buf->end();
+    }
+}
+}  // namespace layout
+
 // below are helper class to combine the formating logics
 template <typename T>
 struct std_container_present_impl
@@ -401,6 +818,12 @@ template <typename T>
 inline std::ostream &operator<<(std::ostream &os,
                                 const pre<std_container_present_impl<T>> t)
 {
+    if (layout::unwrapped(os, t.ctx()))
+    {
+        layout::wrapper w(os, t.ctx());
+        w.os() << t;
+        return os;
+    }
     const auto &pre = t.inner();
     const auto &obj = pre.inner();
     auto ctx = t.ctx();  // copy here
@@ -428,15 +851,16 @@ inline std::ostream &operator<<(std::ostream &os,
 
     size_t outputed_nr = 0;
 
-    os << pre.lb();
+    layout::open(os, ctx, pre.lb());
     auto front_iter = std::cbegin(obj);
     for (size_t i = 0; i < start_size; ++i)
     {
         os << util::pre(*front_iter, ctx);
+        stats::element();
         outputed_nr++;
         if (outputed_nr < output_size)
         {
-            os << pre.sep() << " ";
+            layout::sep(os, ctx, pre.sep());
             start_has_break = true;
         }
         front_iter++;
@@ -445,33 +869,33 @@ inline std::ostream &operator<<(std::ostream &os,
     {
         if (start_size && !start_has_break)
         {
-            os << pre.sep() << " ";
+            layout::sep(os, ctx, pre.sep());
         }
         os << "...";
 
         if (end_size > 0)
         {
-            os << pre.sep() << " ";
+            layout::sep(os, ctx, pre.sep());
         }
     }
-    // auto back_iter = obj.rbegin();
+    // walk back to the first of the tail, then print forwards
     auto back_iter = std::rbegin(obj);
-
-    std::advance(back_iter, end_size);
+    if (end_size > 0)
+    {
+        std::advance(back_iter, end_size - 1);
+    }
     for (size_t i = 0; i < end_size; ++i)
     {
         bool last = i + 1 == end_size;
+        os << util::pre(*back_iter, ctx);
+        stats::element();
         if (!last)
         {
-            os << util::pre(*back_iter, ctx) << pre.sep() << " ";
-        }
-        else
-        {
-            os << util::pre(*back_iter, ctx);
+            layout::sep(os, ctx, pre.sep());
+            back_iter--;
         }
-        back_iter--;
     }
-    os << pre.rb();
+    layout::close(os, ctx, pre.rb());
     if (t.human())
     {
         os << " (sz: " << obj_size << ", ommitted " << ommitted << ")";
@@ -485,8 +909,9 @@ struct std_forward_container_present_impl
     std_forward_container_present_impl(const T &t,
                                        char lb = '[',
                                        char rb = ']',
-                                       char sep = ',')
-        : t_(t), lb_(lb), rb_(rb), sep_(sep)
+                                       char sep = ',',
+                                       bool tail = true)
+        : t_(t), lb_(lb), rb_(rb), sep_(sep), tail_(tail)
     {
     }
     const T &inner() const
@@ -505,49 +930,134 @@ struct std_forward_container_present_impl
     {
         return sep_;
     }
+    // false: print the head only, and stop walking once it is printed
+    bool tail() const
+    {
+        return tail_;
+    }
     const T &t_;
     char lb_;
     char rb_;
     char sep_;
+    bool tail_;
 };
 
+// Forward-only ranges get the same head-and-tail elision in a single
+// pass: the last limit/2 iterators are kept in a ring, so nothing is
+// copied. With size() the tail position is known and no ring is needed.
 template <typename T>
 inline std::ostream &operator<<(
     std::ostream &os, const pre<std_forward_container_present_impl<T>> t)
 {
+    if (layout::unwrapped(os, t.ctx()))
+    {
+        layout::wrapper w(os, t.ctx());
+        w.os() << t;
+        return os;
+    }
     const auto &pre = t.inner();
     const auto &obj = pre.inner();
     auto ctx = t.ctx();  // must copy here
 
-    size_t output_size = t.limit();
+    size_t limit = std::max<ssize_t>(0, t.limit());
+    size_t start_size = pre.tail() ? (limit + 1) / 2 : limit;
+    size_t end_size = limit - start_size;
 
-    os << pre.lb();
-    auto front_iter = obj.cbegin();
-    bool has_more = true;
+    bool first = true;
+    auto emit = [&](const auto &iter)
+    {
+        if (!first)
+        {
+            layout::sep(os, ctx, pre.sep());
+        }
+        first = false;
+        os << util::pre(*iter, ctx);
+        stats::element();
+    };
+    auto ellipsis = [&]()
+    {
+        if (!first)
+        {
+            layout::sep(os, ctx, pre.sep());
+        }
+        first = false;
+        os << "...";
+    };
 
-    if (front_iter == obj.cend())
+    layout::open(os, ctx, pre.lb());
+    auto iter = std::begin(obj);
+    auto end_iter = std::end(obj);
+    size_t obj_size = 0;
+    for (; iter != end_iter && obj_size < start_size; ++iter, ++obj_size)
+    {
+        emit(iter);
+    }
+    if constexpr (sized_v<T>)
     {
-        has_more = false;
+        obj_size = std::size(obj);
+        if (obj_size > limit)
+        {
+            ellipsis();
+            if (end_size == 0)
+            {
+                // no tail to print, do not walk to it
+                iter = end_iter;
+            }
+            else
+            {
+                for (size_t skip = obj_size - limit; skip > 0; --skip)
+                {
+                    ++iter;
+                }
+            }
+        }
+        for (; iter != end_iter; ++iter)
+        {
+            emit(iter);
+        }
     }
     else
     {
-        for (size_t i = 0; i < output_size; ++i)
+        // grows up to min(size, end_size), limit is often unbounded
+        std::vector<decltype(iter)> ring;
+        for (; iter != end_iter; ++iter, ++obj_size)
         {
-            os << util::pre(*front_iter, ctx);
-            front_iter++;
-            if (front_iter == obj.cend())
+            if (end_size == 0)
             {
-                has_more = false;
-                break;
+                // nothing more to print, only the size is left to know
+                if (!t.human())
+                {
+                    ++obj_size;
+                    break;
+                }
+            }
+            else if (ring.size() < end_size)
+            {
+                ring.push_back(iter);
+            }
+            else
+            {
+                ring[(obj_size - start_size) % end_size] = iter;
             }
-            os << ", ";
+        }
+        if (obj_size > limit)
+        {
+            ellipsis();
+        }
+        size_t oldest = ring.size() == end_size && end_size > 0
+                            ? (obj_size - start_size) % end_size
+                            : 0;
+        for (size_t i = 0; i < ring.size(); ++i)
+        {
+            emit(ring[(oldest + i) % ring.size()]);
         }
     }
-    if (has_more)
+    layout::close(os, ctx, pre.rb());
+    if (t.human())
     {
-        os << "...";
+        size_t ommitted = obj_size > limit ? obj_size - limit : 0;
+        os << " (sz: " << obj_size << ", ommitted " << ommitted << ")";
     }
-    os << pre.rb();
     return os;
 }
 
@@ -555,21 +1065,32 @@ inline std::ostream &operator<<(
 template <typename TupType, size_t... I>
 struct std_tuple_present_impl
 {
-    std_tuple_present_impl(const TupType &t, std::index_sequence<I...> i)
-        : t_(t), i_(i)
+    std_tuple_present_impl(const TupType &t,
+                           std::index_sequence<I...> i,
+                           const pre_ctx &ctx = {})
+        : t_(t), i_(i), ctx_(ctx)
     {
     }
     const TupType &t_;
     const std::index_sequence<I...> i_;
+    pre_ctx ctx_;
 };
 
 template <typename TupType, size_t... I>
 inline std::ostream &operator<<(std::ostream &os,
                                 std_tuple_present_impl<TupType, I...> &t)
 {
-    os << "<";
-    (..., (os << (I == 0 ? "" : ", ") << util::pre(std::get<I>(t.t_))));
-    os << ">";
+    if (layout::unwrapped(os, t.ctx_))
+    {
+        layout::wrapper w(os, t.ctx_);
+        w.os() << t;
+        return os;
+    }
+    layout::open(os, t.ctx_, '<');
+    (...,
+     ((I == 0 ? void() : layout::sep(os, t.ctx_, ',')),
+      os << util::pre(std::get<I>(t.t_), t.ctx_)));
+    layout::close(os, t.ctx_, '>');
     return os;
 }
 
@@ -578,514 +1099,5336 @@ inline std::ostream &operator<<(std::ostream &os,
                                 const pre<std::tuple<Types...>> t)
 {
     auto tup = util::std_tuple_present_impl(
-        t.inner(), std::make_index_sequence<sizeof...(Types)>());
+        t.inner(), std::make_index_sequence<sizeof...(Types)>(), t.ctx());
     os << tup;
     return os;
 }
 
+// Ordered mode for unordered containers (ctx.sorted): the `limit` smallest
+// keys are printed in order, so that dumps from different processes are
+// diffable. Only pointers to the elements are sorted, never the elements.
+namespace ordered
+{
+// Below this size all pointers are sorted, above a bounded heap is used.
+constexpr static size_t kSortAll = 64;
+
+template <typename T, typename = void>
+auto constexpr sortable_v = false;
 template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::vector<T>> &vec)
+auto constexpr sortable_v<T, std::enable_if_t<unordered_assoc_v<T>>> =
+    less_comparable_v<typename T::key_type>;
+
+template <typename T>
+const typename T::key_type &key_of(const typename T::value_type &v)
 {
-    os << util::pre(std_container_present_impl(vec.inner(), '[', ']', ','),
-                    vec.ctx());
-    return os;
+    if constexpr (map_like_v<T>)
+    {
+        return v.first;
+    }
+    else
+    {
+        return v;
+    }
 }
 
+// The k smallest elements of t in ascending key order, O(n log k).
 template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::list<T>> &lst)
+std::vector<const typename T::value_type *> smallest(const T &t, size_t k)
 {
-    os << util::pre(std_container_present_impl(lst.inner(), '[', ']', ','),
-                    lst.ctx());
-    return os;
+    using pointer = const typename T::value_type *;
+    auto less = [](pointer a, pointer b)
+    { return key_of<T>(*a) < key_of<T>(*b); };
+    k = std::min(k, t.size());
+    std::vector<pointer> out;
+    if (t.size() <= kSortAll)
+    {
+        out.reserve(t.size());
+        for (const auto &v : t)
+        {
+            out.push_back(&v);
+        }
+        std::partial_sort(out.begin(), out.begin() + k, out.end(), less);
+        out.resize(k);
+        return out;
+    }
+    // a max-heap of the k smallest seen so far
+    out.reserve(k);
+    for (const auto &v : t)
+    {
+        if (out.size() < k)
+        {
+            out.push_back(&v);
+            std::push_heap(out.begin(), out.end(), less);
+        }
+        else if (k && less(&v, out.front()))
+        {
+            std::pop_heap(out.begin(), out.end(), less);
+            out.back() = &v;
+            std::push_heap(out.begin(), out.end(), less);
+        }
+    }
+    std::sort_heap(out.begin(), out.end(), less);
+    return out;
 }
 
 template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::forward_list<T>> &lst)
+struct present_impl
 {
-    os << util::pre(
-        std_forward_container_present_impl(lst.inner(), '[', ']', ','),
-        lst.ctx());
-    return os;
-}
+    explicit present_impl(const T &t) : t_(t)
+    {
+    }
+    const T &inner() const
+    {
+        return t_;
+    }
+    const T &t_;
+};
 
 template <typename T>
 inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::set<T>> &set)
+                                const pre<present_impl<T>> &p)
 {
-    os << util::pre(std_container_present_impl(set.inner(), '{', '}', ','),
-                    set.ctx());
-    return os;
-}
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::multiset<T>> &set)
-{
-    os << util::pre(std_container_present_impl(set.inner(), '{', '}', ','),
-                    set.ctx());
-    return os;
-}
-template <typename K, typename V>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::map<K, V>> &m)
-{
-    os << util::pre(std_container_present_impl(m.inner(), '{', '}', ','),
-                    m.ctx());
-    return os;
-}
-template <typename K, typename V>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::multimap<K, V>> &m)
-{
-    os << util::pre(std_container_present_impl(m.inner(), '{', '}', ','),
-                    m.ctx());
-    return os;
-}
-template <typename K, typename V>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::unordered_map<K, V>> &m)
-{
-    os << util::pre(
-        std_forward_container_present_impl(m.inner(), '{', '}', ','), m.ctx());
-    return os;
-}
-template <typename K, typename V>
-inline std::ostream &operator<<(
-    std::ostream &os, const pre_impl<std::unordered_multimap<K, V>> &m)
-{
-    os << util::pre(
-        std_forward_container_present_impl(m.inner(), '{', '}', ','), m.ctx());
-    return os;
-}
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::unordered_set<T>> &set)
-{
-    os << util::pre(
-        std_forward_container_present_impl(set.inner(), '{', '}', ','),
-        set.ctx());
-    return os;
-}
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::unordered_multiset<T>> &set)
-{
-    os << util::pre(
-        std_forward_container_present_impl(set.inner(), '{', '}', ','),
-        set.ctx());
-    return os;
-}
-template <typename T, size_t size>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::array<T, size>> &p)
-{
-    os << util::pre(std_container_present_impl(p.inner(), '[', ']', ','),
-                    p.ctx());
+    if (layout::unwrapped(os, p.ctx()))
+    {
+        layout::wrapper w(os, p.ctx());
+        w.os() << p;
+        return os;
+    }
+    const auto &obj = p.inner().inner();
+    auto ctx = p.ctx();  // copy here
+
+    size_t size = obj.size();
+    auto elems = smallest(obj, std::max<ssize_t>(0, p.limit()));
+    layout::open(os, ctx, '{');
+    for (size_t i = 0; i < elems.size(); ++i)
+    {
+        os << util::pre(*elems[i], ctx);
+        if (i + 1 < size)
+        {
+            layout::sep(os, ctx, ',');
+        }
+    }
+    if (elems.size() < size)
+    {
+        os << "...";
+    }
+    layout::close(os, ctx, '}');
+    if (p.human())
+    {
+        os << " (sz: " << size << ", ommitted " << size - elems.size()
+           << ")";
+    }
     return os;
 }
+}  // namespace ordered
 
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::deque<T>> &p)
+// Any iterable T, e.g., STL containers with any allocator, comparator or
+// hasher, C-style arrays, std::span, or user-defined ranges.
+// - associative containers (with key_type) use {}, others use []
+// - head-and-tail elision if T has size() and rbegin(), head only otherwise
+// - unordered containers are sorted by key if ctx.sorted
+template <typename T,
+          std::enable_if_t<iterable_v<T> &&
+                               (!ostreamable_v<T> || std::is_array_v<T>),
+                           bool> = true>
+inline std::ostream &operator<<(std::ostream &os, const pre_impl<T> &p)
 {
-    os << util::pre(std_container_present_impl(p.inner(), '[', ']', ','),
-                    p.ctx());
+    char lb = associative_v<T> ? '{' : '[';
+    char rb = associative_v<T> ? '}' : ']';
+    if constexpr (ordered::sortable_v<T>)
+    {
+        if (p.ctx().sorted)
+        {
+            os << util::pre(ordered::present_impl(p.inner()), p.ctx());
+            return os;
+        }
+    }
+    if constexpr (sized_v<T> && bidirectional_v<T>)
+    {
+        os << util::pre(std_container_present_impl(p.inner(), lb, rb, ','),
+                        p.ctx());
+    }
+    else
+    {
+        os << util::pre(
+            std_forward_container_present_impl(p.inner(), lb, rb, ','),
+            p.ctx());
+    }
     return os;
 }
 
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::shared_ptr<T>> &p)
+// Bit containers, std::vector<bool> and std::bitset<N>, are formatted a
+// machine word at a time instead of one proxy reference per bit:
+// - util::pre prints bit strings, bit 0 first for std::vector<bool> and
+//   most significant bit first for std::bitset<N>, as std::bitset does
+// - util::pre_set_bits prints the indexes of set bits, folding runs
+//   into ranges, e.g., {0-3, 8, 10-15}
+namespace bits
 {
-    os << "shared_ptr(" << *p.inner() << ")";
-    return os;
-}
+using word = unsigned long;
+constexpr static size_t kWordBits = sizeof(word) * 8;
+
+// Words of a bit container, bit i of the container is bit i % kWordBits
+// of word i / kWordBits. Bits past size() are zero.
 template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<std::unique_ptr<T>> &p)
+class words;
+
+template <typename A>
+class words<std::vector<bool, A>>
 {
-    os << "unique_ptr(" << *p.inner() << ")";
-    return os;
-}
+public:
+    explicit words(const std::vector<bool, A> &v) : v_(v)
+    {
+    }
+    size_t size() const
+    {
+        return v_.size();
+    }
+    word get(size_t i) const
+    {
+        size_t lo = i * kWordBits;
+        size_t n = std::min(kWordBits, size() - lo);
+#ifdef __GLIBCXX__
+        // libstdc++ stores the bits in words of the same layout
+        word w = v_.begin()._M_p[i];
+        return n == kWordBits ? w : w & ((word(1) << n) - 1);
+#else
+        word w = 0;
+        for (size_t b = 0; b < n; ++b)
+        {
+            w |= word(v_[lo + b]) << b;
+        }
+        return w;
+#endif
+    }
 
-template <typename T,
-          size_t size,
-          std::enable_if_t<!std::is_same_v<T, char>, bool> = true>
-using c_style_array = T[size];
+private:
+    const std::vector<bool, A> &v_;
+};
 
-template <typename T, size_t size>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_impl<c_style_array<T, size>> &p)
+template <size_t N>
+class words<std::bitset<N>>
 {
-    std_container_present_impl c_array_pre(p.inner());
-    auto a = util::pre(c_array_pre, p.ctx());
-    os << a;
-    return os;
-}
+public:
+    explicit words(const std::bitset<N> &b) : b_(b)
+    {
+    }
+    size_t size() const
+    {
+        return N;
+    }
+    word get(size_t i) const
+    {
+#if defined(__GLIBCXX__) || defined(_LIBCPP_VERSION)
+        // both store the bits in an array of words
+        if constexpr (sizeof(std::bitset<N>) % sizeof(word) == 0)
+        {
+            return reinterpret_cast<const word *>(&b_)[i];
+        }
+#endif
+        size_t lo = i * kWordBits;
+        size_t n = std::min(kWordBits, N - lo);
+        word w = 0;
+        for (size_t b = 0; b < n; ++b)
+        {
+            w |= word(b_.test(lo + b)) << b;
+        }
+        return w;
+    }
 
-template <size_t size>
-using c_style_string = char[size];
+private:
+    const std::bitset<N> &b_;
+};
 
-template <size_t size>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre<c_style_string<size>> &p)
+inline size_t popcount(word w)
 {
-    const char *quote = p.ctx().quote_string ? "\"" : "";
-    os << quote << (const char *) p.inner() << quote;
-    return os;
+#ifdef __GNUC__
+    return __builtin_popcountl(w);
+#else
+    size_t n = 0;
+    for (; w; w &= w - 1)
+    {
+        ++n;
+    }
+    return n;
+#endif
 }
 
-inline std::ostream &operator<<(std::ostream &os, const pre<std::string> &p)
+inline size_t ctz(word w)
 {
-    os << "\"" << p.inner() << "\"";
-    return os;
+#ifdef __GNUC__
+    return __builtin_ctzl(w);
+#else
+    size_t n = 0;
+    for (; !(w & 1); w >>= 1)
+    {
+        ++n;
+    }
+    return n;
+#endif
 }
-inline std::ostream &operator<<(std::ostream &os, const pre<std::byte> &p)
+
+// '0'/'1' digits of every byte, least significant bit first
+inline const std::array<std::array<char, 8>, 256> &digits()
 {
-    os << "'" << (char) p.inner() << "'";
-    return os;
+    static const auto table = []
+    {
+        std::array<std::array<char, 8>, 256> t{};
+        for (size_t b = 0; b < 256; ++b)
+        {
+            for (size_t i = 0; i < 8; ++i)
+            {
+                t[b][i] = (b >> i) & 1 ? '1' : '0';
+            }
+        }
+        return t;
+    }();
+    return table;
 }
-inline std::ostream &operator<<(std::ostream &os, const pre<char> &p)
+
+// Write bits [lo, hi) as digits, in ascending order or, if msb_first,
+// descending order.
+template <typename Words>
+void write(std::ostream &os,
+           const Words &w,
+           size_t lo,
+           size_t hi,
+           bool msb_first)
 {
-    os << "'" << p.inner() << "'";
-    return os;
+    constexpr size_t kChunk = 4096;
+    char buf[kChunk];
+    size_t n = 0;
+    char digit[kWordBits];
+    const auto &table = digits();
+    size_t first = lo / kWordBits;
+    size_t last = (hi + kWordBits - 1) / kWordBits;
+    for (size_t k = 0; lo < hi && k < last - first; ++k)
+    {
+        size_t i = msb_first ? last - 1 - k : first + k;
+        word x = w.get(i);
+        for (size_t b = 0; b < sizeof(word); ++b)
+        {
+            const auto &byte = table[(x >> (8 * b)) & 0xff];
+            std::memcpy(digit + 8 * b, byte.data(), 8);
+        }
+        size_t from = std::max(lo, i * kWordBits) - i * kWordBits;
+        size_t to = std::min(hi, (i + 1) * kWordBits) - i * kWordBits;
+        if (n + (to - from) > kChunk)
+        {
+            os.write(buf, n);
+            n = 0;
+        }
+        if (msb_first)
+        {
+            std::reverse_copy(digit + from, digit + to, buf + n);
+        }
+        else
+        {
+            std::memcpy(buf + n, digit + from, to - from);
+        }
+        n += to - from;
+    }
+    os.write(buf, n);
 }
 
-// We do not consider std::pair, std::tuple, std::optinoal, std::atomic, ...
-// as one step deeper.
-// So, use pre<> instead of pre_impl<>
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre<std::optional<T>> &t)
+// Bit string with head-and-tail elision, limit counts bits.
+template <typename Words>
+void print(std::ostream &os,
+           const Words &w,
+           const pre_ctx &ctx,
+           bool msb_first,
+           const char *lb,
+           const char *rb)
 {
-    if (t.inner().has_value())
+    size_t size = w.size();
+    size_t limit = std::max<ssize_t>(0, ctx.limit);
+    os << lb;
+    if (size <= limit)
     {
-        os << "some(" << util::pre(t.inner().value(), t.ctx()) << ")";
+        write(os, w, 0, size, msb_first);
     }
     else
     {
-        os << "nullopt";
+        size_t head = (limit + 1) / 2;
+        size_t tail = limit - head;
+        if (msb_first)
+        {
+            write(os, w, size - head, size, true);
+            os << "...";
+            write(os, w, 0, tail, true);
+        }
+        else
+        {
+            write(os, w, 0, head, false);
+            os << "...";
+            write(os, w, size - tail, size, false);
+        }
+    }
+    os << rb;
+    if (ctx.human)
+    {
+        size_t ommitted = size > limit ? size - limit : 0;
+        os << " (sz: " << size << ", ommitted " << ommitted << ")";
     }
-    return os;
-}
-
-inline std::ostream &operator<<(std::ostream &os, const pre<std::nullopt_t> &)
-{
-    os << "nullopt";
-    return os;
 }
 
-inline std::ostream &operator<<(std::ostream &os, const pre<bool> &p)
+// Set bits as a list of indexes and ranges, limit counts the items.
+template <typename Words>
+void print_set(std::ostream &os, const Words &w, const pre_ctx &ctx)
 {
-    if (p.inner())
+    size_t size = w.size();
+    size_t limit = std::max<ssize_t>(0, ctx.limit);
+    size_t items = 0;
+    size_t set = 0;
+    bool in_run = false;
+    size_t run_lo = 0;
+    size_t run_hi = 0;  // inclusive
+    auto flush = [&]()
     {
-        os << "true";
+        if (!in_run)
+        {
+            return;
+        }
+        in_run = false;
+        if (items < limit)
+        {
+            os << (items ? ", " : "") << run_lo;
+            if (run_hi != run_lo)
+            {
+                os << '-' << run_hi;
+            }
+        }
+        else if (items == limit)
+        {
+            os << (items ? ", " : "") << "...";
+        }
+        ++items;
+    };
+    os << '{';
+    for (size_t i = 0; i * kWordBits < size; ++i)
+    {
+        word x = w.get(i);
+        set += popcount(x);
+        if (items > limit && !ctx.human)
+        {
+            break;
+        }
+        size_t base = i * kWordBits;
+        if (x == ~word(0) && in_run && run_hi + 1 == base)
+        {
+            run_hi = base + kWordBits - 1;
+            continue;
+        }
+        for (; x; x &= x - 1)
+        {
+            size_t bit = base + ctz(x);
+            if (in_run && run_hi + 1 == bit)
+            {
+                run_hi = bit;
+                continue;
+            }
+            flush();
+            in_run = true;
+            run_lo = run_hi = bit;
+        }
     }
-    else
+    flush();
+    os << '}';
+    if (ctx.human)
     {
-        os << "false";
+        os << " (sz: " << size << ", set: " << set << ")";
     }
-    return os;
 }
+}  // namespace bits
 
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os, const pre<std::atomic<T>> &t)
+template <typename A>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_impl<std::vector<bool, A>> &p)
 {
-    os << "atomic("
-       << util::pre(t.inner().load(std::memory_order_relaxed), t.ctx()) << ")";
+    bits::words<std::vector<bool, A>> w(p.inner());
+    bits::print(os, w, p.ctx(), false, "[", "]");
     return os;
 }
 
-template <typename T, typename U>
-inline std::ostream &operator<<(std::ostream &os, const pre<std::pair<T, U>> &s)
+template <size_t N>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_impl<std::bitset<N>> &p)
 {
-    const auto &t = s.inner();
-    os << "(" << util::pre(t.first, s.ctx()) << ", "
-       << util::pre(t.second, s.ctx()) << ")";
+    bits::words<std::bitset<N>> w(p.inner());
+    bits::print(os, w, p.ctx(), true, "", "");
     return os;
 }
 
-// a hack to get the internal container of any adaptors
-// https://stackoverflow.com/questions/1185252/is-there-a-way-to-access-the-underlying-container-of-stl-container-adaptors
-template <class ADAPTER>
-const typename ADAPTER::container_type &get_container(const ADAPTER &a)
+// Indexes of the set bits of a std::vector<bool> or std::bitset<N>, e.g.,
+// util::pre_set_bits(bitmap) prints {0-3, 8, 10-15}.
+template <typename T>
+class pre_set_bits
 {
-    struct hack : ADAPTER
+public:
+    pre_set_bits(const T &t, const pre_ctx &ctx = {}) : t_(t), ctx_(ctx)
     {
-        static const typename ADAPTER::container_type &get(const ADAPTER &a)
-        {
-            return a.*(&hack::c);
-        }
-    };
-    return hack::get(a);
-}
+    }
+    const T &inner() const
+    {
+        return t_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
 
-// for adaptors, we fordward straightly.
-// Use pre<> instead of pre_impl<>
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os, const pre<std::queue<T>> &s)
-{
-    const auto &t = s.inner();
-    const auto &c = get_container(t);
-    os << util::pre(c, s.ctx());
-    return os;
-}
+private:
+    const T &t_;
+    pre_ctx ctx_;
+};
 
 template <typename T>
-inline std::ostream &operator<<(std::ostream &os, const pre<std::stack<T>> &s)
+inline std::ostream &operator<<(std::ostream &os, const pre_set_bits<T> &p)
 {
-    const auto &t = s.inner();
-    const auto &c = get_container(t);
-    os << util::pre(c, s.ctx());
+    bits::print_set(os, bits::words<T>(p.inner()), p.ctx());
     return os;
 }
 
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre<std::priority_queue<T>> &s)
+// Lazy views, evaluated while printing, e.g., util::pre_filter(m, pred)
+// or util::pre_keys(m). Nothing is materialized, and `limit` applies to
+// the elements of the view.
+namespace views
 {
-    const auto &t = s.inner();
-    const auto &c = get_container(t);
-    os << util::pre(c, s.ctx());
-    return os;
-}
+template <typename C>
+using base_iterator = decltype(std::begin(std::declval<const C &>()));
 
-template <typename T>
-std::string pre_str(const T &t)
+template <typename C>
+auto constexpr bidirectional_base_v = std::is_base_of_v<
+    std::bidirectional_iterator_tag,
+    typename std::iterator_traits<base_iterator<C>>::iterator_category>;
+
+// f(e) for every element e of c
+template <typename C, typename F>
+class transform_view
 {
-    std::stringstream ss;
-    ss << util::pre(t);
-    return ss.str();
-}
+public:
+    class iterator
+    {
+    public:
+        using iterator_category =
+            std::conditional_t<bidirectional_base_v<C>,
+                               std::bidirectional_iterator_tag,
+                               std::forward_iterator_tag>;
+        using reference = decltype(std::declval<const F &>()(
+            *std::declval<base_iterator<C>>()));
+        using value_type = std::decay_t<reference>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
 
-// https://github.com/Sinacam/ezprint
-// https://stackoverflow.com/questions/64777768/easy-way-to-cout-any-struct-in-c
-namespace fallback
-{
-struct ubiq
+        iterator(base_iterator<C> it, const F *f) : it_(it), f_(f)
+        {
+        }
+        reference operator*() const
+        {
+            return (*f_)(*it_);
+        }
+        iterator &operator++()
+        {
+            ++it_;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            auto ret = *this;
+            ++it_;
+            return ret;
+        }
+        iterator &operator--()
+        {
+            --it_;
+            return *this;
+        }
+        iterator operator--(int)
+        {
+            auto ret = *this;
+            --it_;
+            return ret;
+        }
+        bool operator==(const iterator &o) const
+        {
+            return it_ == o.it_;
+        }
+        bool operator!=(const iterator &o) const
+        {
+            return it_ != o.it_;
+        }
+
+    private:
+        base_iterator<C> it_;
+        const F *f_;
+    };
+
+    transform_view(const C &c, F f) : c_(c), f_(std::move(f))
+    {
+    }
+    iterator begin() const
+    {
+        return {std::begin(c_), &f_};
+    }
+    iterator end() const
+    {
+        return {std::end(c_), &f_};
+    }
+    // Sized and reversible as long as C is, for head-and-tail elision.
+    template <typename U = C,
+              typename = decltype(std::size(std::declval<const U &>()))>
+    size_t size() const
+    {
+        return std::size(c_);
+    }
+    template <typename U = C,
+              typename = std::enable_if_t<bidirectional_base_v<U>>>
+    auto rbegin() const
+    {
+        return std::make_reverse_iterator(end());
+    }
+    template <typename U = C,
+              typename = std::enable_if_t<bidirectional_base_v<U>>>
+    auto rend() const
+    {
+        return std::make_reverse_iterator(begin());
+    }
+
+private:
+    const C &c_;
+    F f_;
+};
+
+// the elements e of c with pred(e)
+template <typename C, typename P>
+class filter_view
 {
-    template <typename T>
-    operator T();
+public:
+    class iterator
+    {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using reference =
+            typename std::iterator_traits<base_iterator<C>>::reference;
+        using value_type =
+            typename std::iterator_traits<base_iterator<C>>::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+
+        iterator(base_iterator<C> it, base_iterator<C> end, const P *pred)
+            : it_(it), end_(end), pred_(pred)
+        {
+            skip();
+        }
+        reference operator*() const
+        {
+            return *it_;
+        }
+        iterator &operator++()
+        {
+            ++it_;
+            skip();
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const iterator &o) const
+        {
+            return it_ == o.it_;
+        }
+        bool operator!=(const iterator &o) const
+        {
+            return it_ != o.it_;
+        }
+
+    private:
+        void skip()
+        {
+            while (it_ != end_ && !(*pred_)(*it_))
+            {
+                ++it_;
+            }
+        }
+        base_iterator<C> it_;
+        base_iterator<C> end_;
+        const P *pred_;
+    };
+
+    filter_view(const C &c, P pred) : c_(c), pred_(std::move(pred))
+    {
+    }
+    iterator begin() const
+    {
+        return {std::begin(c_), std::end(c_), &pred_};
+    }
+    iterator end() const
+    {
+        return {std::end(c_), std::end(c_), &pred_};
+    }
+
+private:
+    const C &c_;
+    P pred_;
 };
 
-template <size_t>
-using ubiq_t = ubiq;
+struct first_of
+{
+    template <typename Pair>
+    const auto &operator()(const Pair &p) const
+    {
+        return p.first;
+    }
+};
+struct second_of
+{
+    template <typename Pair>
+    const auto &operator()(const Pair &p) const
+    {
+        return p.second;
+    }
+};
 
-// select the one with T{Ubiqs{}...} a valid statement (compiled and has type)
-// Since Ubiqs{} can turn into any types,
-// It only succeeds when number of Ubiqs{}... equals to the # of fields of T.
-// With too many Ubiqs{}..., CE: excess elements in struct initializer
-template <typename T, typename... Ubiqs>
-constexpr auto count_r(size_t &sz, int) -> std::void_t<decltype(T{Ubiqs{}...})>
+// Head-and-tail if that is O(limit), otherwise the head only, so the
+// walk stops once `limit` elements are printed.
+template <typename View>
+inline std::ostream &print(std::ostream &os, const pre_impl<View> &p)
 {
-    sz = sizeof...(Ubiqs);
+    if constexpr (sized_v<View> && bidirectional_v<View>)
+    {
+        os << util::pre(std_container_present_impl(p.inner()), p.ctx());
+    }
+    else
+    {
+        os << util::pre(std_forward_container_present_impl(
+                            p.inner(), '[', ']', ',', false),
+                        p.ctx());
+    }
+    return os;
 }
 
-// effectively calling count_r<T, Ubiqs - 1>
-template <typename T, typename, typename... Ubiqs>
-constexpr auto count_r(size_t &sz, float)
+// A view with its ctx, as returned by util::pre_filter and friends
+template <typename View>
+class printable
 {
-    count_r<T, Ubiqs...>(sz, 0);
+public:
+    printable(View v, const pre_ctx &ctx) : v_(std::move(v)), ctx_(ctx)
+    {
+    }
+    const View &inner() const
+    {
+        return v_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
+
+private:
+    View v_;
+    pre_ctx ctx_;
+};
+
+template <typename View>
+inline std::ostream &operator<<(std::ostream &os, const printable<View> &p)
+{
+    os << util::pre(p.inner(), p.ctx());
+    return os;
 }
+}  // namespace views
 
-// Return the number of fields in T
-template <typename T, size_t... Is>
-constexpr auto count(std::index_sequence<Is...>)
+template <typename C, typename F>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_impl<views::transform_view<C, F>> &p)
 {
-    size_t sz = 0;
-    count_r<T, ubiq_t<Is>...>(sz, 0);
-    return sz;
+    return views::print(os, p);
 }
 
-constexpr static size_t kMaxFieldNr = 32;
+template <typename C, typename P>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_impl<views::filter_view<C, P>> &p)
+{
+    return views::print(os, p);
+}
 
-template <typename T>
-constexpr auto count()
+// The elements e of c with pred(e)
+template <typename C, typename P>
+inline auto pre_filter(const C &c, P pred, const pre_ctx &ctx = {})
 {
-    constexpr size_t count_nr = std::min(sizeof(T), kMaxFieldNr);
-    return count<T>(std::make_index_sequence<count_nr>{});
+    return views::printable<views::filter_view<C, P>>{{c, std::move(pred)},
+                                                      ctx};
 }
-template <typename T>
-inline auto as_tuple(T &&, std::integral_constant<size_t, 0>)
+
+// f(e) for every element e of c
+template <typename C, typename F>
+inline auto pre_transform(const C &c, F f, const pre_ctx &ctx = {})
 {
-    return std::tuple{};
+    return views::printable<views::transform_view<C, F>>{{c, std::move(f)},
+                                                         ctx};
 }
 
-#define DEFINE_AS_TUPLE(N, ...)                                    \
-    template <typename T>                                          \
-    inline auto as_tuple(T &&t, std::integral_constant<size_t, N>) \
-    {                                                              \
-        static_assert(N <= kMaxFieldNr, "Tune up kMaxFieldNr");    \
-        auto &[__VA_ARGS__] = t;                                   \
-        return std::forward_as_tuple(__VA_ARGS__);                 \
-    }
-// clang-format off
-DEFINE_AS_TUPLE(1, x0)
-DEFINE_AS_TUPLE(2, x0, x1)
-DEFINE_AS_TUPLE(3, x0, x1, x2)
-DEFINE_AS_TUPLE(4, x0, x1, x2, x3)
-DEFINE_AS_TUPLE(5, x0, x1, x2, x3, x4)
-DEFINE_AS_TUPLE(6, x0, x1, x2, x3, x4, x5)
-DEFINE_AS_TUPLE(7, x0, x1, x2, x3, x4, x5, x6)
-DEFINE_AS_TUPLE(8, x0, x1, x2, x3, x4, x5, x6, x7)
-DEFINE_AS_TUPLE(9, x0, x1, x2, x3, x4, x5, x6, x7, x8)
-DEFINE_AS_TUPLE(10, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9)
-DEFINE_AS_TUPLE(11, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10)
-DEFINE_AS_TUPLE(12, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11)
-DEFINE_AS_TUPLE(13, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12)
-DEFINE_AS_TUPLE(14, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13)
-DEFINE_AS_TUPLE(15, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14)
-DEFINE_AS_TUPLE(16, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15)
-DEFINE_AS_TUPLE(17, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16)
-DEFINE_AS_TUPLE(18, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17)
-DEFINE_AS_TUPLE(19, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18)
-DEFINE_AS_TUPLE(20, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19)
-DEFINE_AS_TUPLE(21, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20)
-DEFINE_AS_TUPLE(22, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21)
-DEFINE_AS_TUPLE(23, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22)
-DEFINE_AS_TUPLE(24, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23)
-DEFINE_AS_TUPLE(25, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24)
-DEFINE_AS_TUPLE(26, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24, x25)
-DEFINE_AS_TUPLE(27, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26)
-DEFINE_AS_TUPLE(28, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27)
-DEFINE_AS_TUPLE(29, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28)
-DEFINE_AS_TUPLE(30, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29)
-DEFINE_AS_TUPLE(31, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-    x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29, x30)
-DEFINE_AS_TUPLE(32, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
-                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29, x30, x31)
-// clang-format on
-}  // namespace fallback
+// The keys of a map
+template <typename M>
+inline auto pre_keys(const M &m, const pre_ctx &ctx = {})
+{
+    return pre_transform(m, views::first_of{}, ctx);
+}
 
-// We consider aggregated structures as containers
-// use pre_impl to update ctx
-template <typename T, std::enable_if_t<!ostreamable_v<T>, bool> = true>
-inline std::ostream &operator<<(std::ostream &os, const pre_impl<T> &t)
+// The mapped values of a map
+template <typename M>
+inline auto pre_values(const M &m, const pre_ctx &ctx = {})
 {
-    auto tup = util::fallback::as_tuple(
-        t.inner(),
-        std::integral_constant<size_t, util::fallback::count<T>()>{});
-    os << "{" << names::get_type_name<T>() << " " << util::pre(tup, t.ctx())
-       << "}";
-    return os;
+    return pre_transform(m, views::second_of{}, ctx);
 }
 
-template <typename T>
-struct pre_with_name
+namespace views
 {
-    pre_with_name(const T &t, const char *n) : t_(t), name_(n)
+// [first, last) of a container C, printed with the brackets of C.
+// size is what printing needs, see bounded_distance.
+template <typename C>
+class subrange
+{
+public:
+    subrange(base_iterator<C> first, base_iterator<C> last, size_t size)
+        : first_(first), last_(last), size_(size)
     {
     }
+    base_iterator<C> begin() const
+    {
+        return first_;
+    }
+    base_iterator<C> end() const
+    {
+        return last_;
+    }
+    size_t size() const
+    {
+        return size_;
+    }
+    auto rbegin() const
+    {
+        return std::make_reverse_iterator(last_);
+    }
+    auto rend() const
+    {
+        return std::make_reverse_iterator(first_);
+    }
 
-    const T &t_;
-    const char *name_;
+private:
+    base_iterator<C> first_;
+    base_iterator<C> last_;
+    size_t size_;
 };
 
-template <typename T>
-inline std::ostream &operator<<(std::ostream &os, const pre_with_name<T> &p)
+// The size of [first, last) as far as printing it under ctx needs: exact
+// for random access or human output. Otherwise at most limit + 1 steps are
+// walked, which is enough to tell whether the middle is elided.
+template <typename It>
+size_t bounded_distance(It first, It last, const pre_ctx &ctx)
 {
-    os << p.name_ << ": " << util::pre(p.t_);
-    return os;
+    if constexpr (std::is_base_of_v<
+                      std::random_access_iterator_tag,
+                      typename std::iterator_traits<It>::iterator_category>)
+    {
+        return last - first;
+    }
+    else
+    {
+        size_t n = 0;
+        size_t cap = ctx.human ? std::numeric_limits<size_t>::max()
+                               : size_t(std::max<ssize_t>(ctx.limit, 0)) + 1;
+        for (; first != last && n < cap; ++first)
+        {
+            ++n;
+        }
+        return n;
+    }
 }
 
-template <typename T, typename... Ts>
-struct pre_with_names
+// The order of the keys in c: its key_comp(), or operator< for sorted
+// sequences, as std::lower_bound uses
+template <typename C>
+auto key_less(const C &c)
 {
-    pre_with_names(const T &t, const Ts &...ts)
-        : ptrs_({(void *) &t, (void *) &ts...})
+    if constexpr (ordered_assoc_v<C>)
     {
+        return c.key_comp();
     }
-    std::vector<void *> ptrs_;
-};
+    else
+    {
+        return std::less<>();
+    }
+}
 
-template <typename T, typename... Ts>
-struct pre_with_names_view
+// The first element not less than key, by the container's own lookup for
+// ordered associative containers, by binary search for sorted sequences.
+template <typename C, typename K>
+base_iterator<C> lower_bound(const C &c, const K &key)
 {
-    pre_with_names_view(size_t idx, const std::vector<void *> &view)
-        : idx_(idx), views_(view)
+    if constexpr (ordered_assoc_v<C>)
     {
+        return c.lower_bound(key);
     }
-    mutable size_t idx_{};
-    const std::vector<void *> &views_{};
-};
+    else
+    {
+        static_assert(random_access_v<C>,
+                      "needs an ordered container or a sorted sequence");
+        return std::lower_bound(std::begin(c), std::end(c), key);
+    }
+}
+}  // namespace views
 
-template <typename T, typename... Ts>
+template <typename C>
 inline std::ostream &operator<<(std::ostream &os,
-                                const pre_with_names<T, Ts...> &p)
+                                const pre_impl<views::subrange<C>> &p)
 {
-    pre_with_names_view<T, Ts...> view(0, p.ptrs_);
-    os << view;
+    char lb = associative_v<C> ? '{' : '[';
+    char rb = associative_v<C> ? '}' : ']';
+    os << util::pre(std_container_present_impl(p.inner(), lb, rb, ','),
+                    p.ctx());
     return os;
 }
 
-template <typename T, typename... Ts>
-inline std::ostream &operator<<(std::ostream &os,
-                                const pre_with_names_view<T, Ts...> &view)
+// The elements of c with keys in [lo, hi), O(log n + k) for k elements.
+// c is an ordered associative container or a sorted random-access one.
+template <typename C, typename K>
+inline auto pre_range(const C &c,
+                      const K &lo,
+                      const K &hi,
+                      const pre_ctx &ctx = {})
 {
-    pre_ctx ctx;
-    // C macro store the name as c_style_string,
-    // but we don't want to print the quote.
-    ctx.quote_string = false;
-
-    os << util::pre(*(T *) (view.views_[view.idx_]), ctx);
-    if constexpr (sizeof...(Ts) > 0)
+    auto first = views::lower_bound(c, lo);
+    auto last = first;
+    // hi before lo in the order of c: empty, never an inverted range
+    if (!views::key_less(c)(hi, lo))
     {
-        os << pre_with_names_view<Ts...>(view.idx_ + 1, view.views_);
+        last = views::lower_bound(c, hi);
     }
-    return os;
+    return views::printable<views::subrange<C>>{
+        {first, last, views::bounded_distance(first, last, ctx)}, ctx};
+}
+
+// Up to k elements on each side of the first element not less than key,
+// which is included, O(log n + k).
+template <typename C, typename K>
+inline auto pre_around(const C &c,
+                       const K &key,
+                       size_t k,
+                       const pre_ctx &ctx = {})
+{
+    auto first = views::lower_bound(c, key);
+    auto last = first;
+    size_t size = 0;
+    for (; size < k && first != std::begin(c); ++size)
+    {
+        --first;
+    }
+    for (size_t i = 0; i <= k && last != std::end(c); ++i, ++size)
+    {
+        ++last;
+    }
+    return views::printable<views::subrange<C>>{{first, last, size}, ctx};
+}
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_impl<std::shared_ptr<T>> &p)
+{
+    os << "shared_ptr(" << *p.inner() << ")";
+    return os;
+}
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_impl<std::unique_ptr<T>> &p)
+{
+    os << "unique_ptr(" << *p.inner() << ")";
+    return os;
+}
+
+inline bool gathered(std::ostream &os, const char *data, size_t size)
+{
+    auto *buf = static_cast<gather_buf *>(os.pword(gather_buf::index()));
+    return buf && buf->gather(data, size);
+}
+
+template <size_t size>
+using c_style_string = char[size];
+
+template <size_t size>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre<c_style_string<size>> &p)
+{
+    const char *quote = p.ctx().quote_string ? "\"" : "";
+    os << quote << (const char *) p.inner() << quote;
+    return os;
+}
+
+template <typename Traits, typename Alloc>
+inline std::ostream &operator<<(
+    std::ostream &os, const pre<std::basic_string<char, Traits, Alloc>> &p)
+{
+    os << "\"";
+    if (!gathered(os, p.inner().data(), p.inner().size()))
+    {
+        os << p.inner();
+    }
+    os << "\"";
+    return os;
+}
+template <typename Traits>
+inline std::ostream &operator<<(
+    std::ostream &os, const pre<std::basic_string_view<char, Traits>> &p)
+{
+    os << "\"";
+    if (!gathered(os, p.inner().data(), p.inner().size()))
+    {
+        os << p.inner();
+    }
+    os << "\"";
+    return os;
+}
+inline std::ostream &operator<<(std::ostream &os, const pre<std::byte> &p)
+{
+    os << "'" << (char) p.inner() << "'";
+    return os;
+}
+inline std::ostream &operator<<(std::ostream &os, const pre<char> &p)
+{
+    os << "'" << p.inner() << "'";
+    return os;
+}
+
+// We do not consider std::pair, std::tuple, std::optinoal, std::atomic, ...
+// as one step deeper.
+// So, use pre<> instead of pre_impl<>
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre<std::optional<T>> &t)
+{
+    if (t.inner().has_value())
+    {
+        os << "some(" << util::pre(t.inner().value(), t.ctx()) << ")";
+    }
+    else
+    {
+        os << "nullopt";
+    }
+    return os;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const pre<std::nullopt_t> &)
+{
+    os << "nullopt";
+    return os;
+}
+
+inline std::ostream &operator<<(std::ostream &os, const pre<bool> &p)
+{
+    if (p.inner())
+    {
+        os << "true";
+    }
+    else
+    {
+        os << "false";
+    }
+    return os;
+}
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const pre<std::atomic<T>> &t)
+{
+    os << "atomic("
+       << util::pre(t.inner().load(std::memory_order_relaxed), t.ctx()) << ")";
+    return os;
+}
+
+template <typename T, typename U>
+inline std::ostream &operator<<(std::ostream &os, const pre<std::pair<T, U>> &s)
+{
+    if (layout::unwrapped(os, s.ctx()))
+    {
+        layout::wrapper w(os, s.ctx());
+        w.os() << s;
+        return os;
+    }
+    const auto &t = s.inner();
+    layout::open(os, s.ctx(), '(');
+    os << util::pre(t.first, s.ctx());
+    layout::sep(os, s.ctx(), ',');
+    os << util::pre(t.second, s.ctx());
+    layout::close(os, s.ctx(), ')');
+    return os;
+}
+
+// a hack to get the internal container of any adaptors
+// https://stackoverflow.com/questions/1185252/is-there-a-way-to-access-the-underlying-container-of-stl-container-adaptors
+template <class ADAPTER>
+const typename ADAPTER::container_type &get_container(const ADAPTER &a)
+{
+    struct hack : ADAPTER
+    {
+        static const typename ADAPTER::container_type &get(const ADAPTER &a)
+        {
+            return a.*(&hack::c);
+        }
+    };
+    return hack::get(a);
+}
+
+// for adaptors, we fordward straightly.
+// Use pre<> instead of pre_impl<>
+template <typename T, typename C>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre<std::queue<T, C>> &s)
+{
+    const auto &t = s.inner();
+    const auto &c = get_container(t);
+    os << util::pre(c, s.ctx());
+    return os;
+}
+
+template <typename T, typename C>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre<std::stack<T, C>> &s)
+{
+    const auto &t = s.inner();
+    const auto &c = get_container(t);
+    os << util::pre(c, s.ctx());
+    return os;
+}
+
+// the same hack for the comparator of std::priority_queue
+template <class ADAPTER>
+const typename ADAPTER::value_compare &get_comparator(const ADAPTER &a)
+{
+    struct hack : ADAPTER
+    {
+        static const typename ADAPTER::value_compare &get(const ADAPTER &a)
+        {
+            return a.*(&hack::comp);
+        }
+    };
+    return hack::get(a);
+}
+
+// priority_queue prints in priority order, i.e., the order of pop().
+// The children of a popped node are the only new candidates, so the top
+// `limit` elements are found by walking the heap array with a small heap
+// of indices: O(k log k), and the elements are never copied or moved.
+template <typename T, typename C, typename Cmp>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre<std::priority_queue<T, C, Cmp>> &s)
+{
+    if (layout::unwrapped(os, s.ctx()))
+    {
+        layout::wrapper w(os, s.ctx());
+        w.os() << s;
+        return os;
+    }
+    const auto &t = s.inner();
+    const auto &c = get_container(t);
+    const auto &cmp = get_comparator(t);
+    auto ctx = s.ctx();  // copy here
+
+    size_t size = t.size();
+    size_t output_size =
+        std::min<size_t>(size, std::max<ssize_t>(0, s.limit()));
+    auto less = [&](size_t a, size_t b) { return cmp(c[a], c[b]); };
+    std::vector<size_t> candidates;
+    candidates.reserve(output_size + 1);
+    if (size)
+    {
+        candidates.push_back(0);
+    }
+
+    layout::open(os, ctx, '[');
+    for (size_t i = 0; i < output_size; ++i)
+    {
+        std::pop_heap(candidates.begin(), candidates.end(), less);
+        size_t top = candidates.back();
+        candidates.pop_back();
+        os << util::pre(c[top], ctx);
+        if (i + 1 < size)
+        {
+            layout::sep(os, ctx, ',');
+        }
+        for (size_t child = 2 * top + 1; child <= 2 * top + 2; ++child)
+        {
+            if (child < size)
+            {
+                candidates.push_back(child);
+                std::push_heap(candidates.begin(), candidates.end(), less);
+            }
+        }
+    }
+    if (output_size < size)
+    {
+        os << "...";
+    }
+    layout::close(os, ctx, ']');
+    if (s.human())
+    {
+        os << " (sz: " << size << ", ommitted " << size - output_size << ")";
+    }
+    return os;
+}
+
+template <typename T>
+std::string pre_str(const T &t)
+{
+    std::stringstream ss;
+    ss << util::pre(t);
+    return ss.str();
+}
+
+// https://github.com/Sinacam/ezprint
+// https://stackoverflow.com/questions/64777768/easy-way-to-cout-any-struct-in-c
+namespace fallback
+{
+struct ubiq
+{
+    template <typename T>
+    operator T();
+};
+
+template <size_t>
+using ubiq_t = ubiq;
+
+// select the one with T{Ubiqs{}...} a valid statement (compiled and has type)
+// Since Ubiqs{} can turn into any types,
+// It only succeeds when number of Ubiqs{}... equals to the # of fields of T.
+// With too many Ubiqs{}..., CE: excess elements in struct initializer
+template <typename T, typename... Ubiqs>
+constexpr auto count_r(size_t &sz, int) -> std::void_t<decltype(T{Ubiqs{}...})>
+{
+    sz = sizeof...(Ubiqs);
+}
+
+// effectively calling count_r<T, Ubiqs - 1>
+template <typename T, typename, typename... Ubiqs>
+constexpr auto count_r(size_t &sz, float)
+{
+    count_r<T, Ubiqs...>(sz, 0);
+}
+
+// Return the number of fields in T
+template <typename T, size_t... Is>
+constexpr auto count(std::index_sequence<Is...>)
+{
+    size_t sz = 0;
+    count_r<T, ubiq_t<Is>...>(sz, 0);
+    return sz;
+}
+
+constexpr static size_t kMaxFieldNr = 32;
+
+template <typename T>
+constexpr auto count()
+{
+    constexpr size_t count_nr = std::min(sizeof(T), kMaxFieldNr);
+    return count<T>(std::make_index_sequence<count_nr>{});
+}
+template <typename T>
+inline auto as_tuple(T &&, std::integral_constant<size_t, 0>)
+{
+    return std::tuple{};
+}
+
+#define DEFINE_AS_TUPLE(N, ...)                                    \
+    template <typename T>                                          \
+    inline auto as_tuple(T &&t, std::integral_constant<size_t, N>) \
+    {                                                              \
+        static_assert(N <= kMaxFieldNr, "Tune up kMaxFieldNr");    \
+        auto &[__VA_ARGS__] = t;                                   \
+        return std::forward_as_tuple(__VA_ARGS__);                 \
+    }
+// clang-format off
+DEFINE_AS_TUPLE(1, x0)
+DEFINE_AS_TUPLE(2, x0, x1)
+DEFINE_AS_TUPLE(3, x0, x1, x2)
+DEFINE_AS_TUPLE(4, x0, x1, x2, x3)
+DEFINE_AS_TUPLE(5, x0, x1, x2, x3, x4)
+DEFINE_AS_TUPLE(6, x0, x1, x2, x3, x4, x5)
+DEFINE_AS_TUPLE(7, x0, x1, x2, x3, x4, x5, x6)
+DEFINE_AS_TUPLE(8, x0, x1, x2, x3, x4, x5, x6, x7)
+DEFINE_AS_TUPLE(9, x0, x1, x2, x3, x4, x5, x6, x7, x8)
+DEFINE_AS_TUPLE(10, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9)
+DEFINE_AS_TUPLE(11, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10)
+DEFINE_AS_TUPLE(12, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11)
+DEFINE_AS_TUPLE(13, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12)
+DEFINE_AS_TUPLE(14, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13)
+DEFINE_AS_TUPLE(15, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14)
+DEFINE_AS_TUPLE(16, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15)
+DEFINE_AS_TUPLE(17, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16)
+DEFINE_AS_TUPLE(18, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17)
+DEFINE_AS_TUPLE(19, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18)
+DEFINE_AS_TUPLE(20, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19)
+DEFINE_AS_TUPLE(21, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20)
+DEFINE_AS_TUPLE(22, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21)
+DEFINE_AS_TUPLE(23, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22)
+DEFINE_AS_TUPLE(24, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23)
+DEFINE_AS_TUPLE(25, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24)
+DEFINE_AS_TUPLE(26, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24, x25)
+DEFINE_AS_TUPLE(27, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26)
+DEFINE_AS_TUPLE(28, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27)
+DEFINE_AS_TUPLE(29, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28)
+DEFINE_AS_TUPLE(30, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29)
+DEFINE_AS_TUPLE(31, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+    x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29, x30)
+DEFINE_AS_TUPLE(32, x0, x1, x2, x3, x4, x5, x6, x7, x8, x9, x10, x11, x12, x13, x14, x15, x16,
+                x17, x18, x19, x20, x21, x22, x23, x24, x25, x26, x27, x28, x29, x30, x31)
+// clang-format on
+
+// The fields of an aggregate T as a tuple of references
+template <typename T>
+inline auto as_tuple(const T &t)
+{
+    return as_tuple(t, std::integral_constant<size_t, count<T>()>{});
+}
+}  // namespace fallback
+
+// We consider aggregated structures as containers
+// use pre_impl to update ctx
+template <typename T,
+          std::enable_if_t<!ostreamable_v<T> && !iterable_v<T>, bool> = true>
+inline std::ostream &operator<<(std::ostream &os, const pre_impl<T> &t)
+{
+    auto tup = util::fallback::as_tuple(
+        t.inner(),
+        std::integral_constant<size_t, util::fallback::count<T>()>{});
+    os << "{" << names::get_type_name<T>() << " " << util::pre(tup, t.ctx())
+       << "}";
+    return os;
+}
+
+// A std::streambuf appending everything into a std::string.
+// Used to format a whole record before handing it to the sink at once.
+class line_buf : public std::streambuf
+{
+public:
+    const std::string &str() const
+    {
+        return buf_;
+    }
+    void clear()
+    {
+        buf_.clear();
+    }
+    // Release the memory if some huge record inflated the buffer
+    void shrink(size_t keep)
+    {
+        if (buf_.capacity() > keep)
+        {
+            std::string().swap(buf_);
+        }
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            buf_.push_back(traits_type::to_char_type(ch));
+        }
+        return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        buf_.append(s, n);
+        return n;
+    }
+
+private:
+    std::string buf_;
+};
+
+// Structural diff between two snapshots of the same type. See pre_diff.
+// Only the changes are printed:
+// - leaves: "before -> after"
+// - sequences: "~[i]: <diff>", "-[i]: before", "+[j]: after"
+// - maps: "~k: <diff>", "-k: before", "+k: after"
+// - sets: "-v", "+v"
+// - tuples and aggregates (field by field): "~#i: <diff>"
+// Unchanged runs collapse into "(n unchanged)".
+// ctx.limit caps the number of changes shown, ctx.depth the nesting.
+namespace diff
+{
+template <typename T, typename = void>
+auto constexpr equality_comparable_v = false;
+template <typename T>
+auto constexpr equality_comparable_v<
+    T,
+    std::void_t<decltype(std::declval<const T &>() ==
+                         std::declval<const T &>())>> = true;
+
+template <typename T>
+auto constexpr tuple_like_v = false;
+template <typename T, typename U>
+auto constexpr tuple_like_v<std::pair<T, U>> = true;
+template <typename... Ts>
+auto constexpr tuple_like_v<std::tuple<Ts...>> = true;
+
+template <typename T>
+auto constexpr optional_v = false;
+template <typename T>
+auto constexpr optional_v<std::optional<T>> = true;
+
+// Edit scripts larger than kMaxEditDistance, or taking more than
+// kMaxDiffSteps element comparisons to find, fall back to positional diff.
+constexpr static size_t kMaxEditDistance = 256;
+constexpr static size_t kMaxDiffSteps = 1 << 16;
+
+// unordered_multiset and unordered_multimap: find() returns only the first
+// element of a key, compare whole equal_range()s instead
+template <typename T, typename = void>
+auto constexpr multi_key_v = false;
+template <typename T>
+auto constexpr multi_key_v<
+    T,
+    std::enable_if_t<std::is_same_v<
+        decltype(std::declval<T &>().insert(
+            std::declval<const typename T::value_type &>())),
+        typename T::iterator>>> = true;
+
+template <typename T>
+bool equal(const T &a, const T &b);
+
+template <typename Tup, size_t... I>
+inline bool equal_tuple(const Tup &a, const Tup &b, std::index_sequence<I...>)
+{
+    return (... && equal(std::get<I>(a), std::get<I>(b)));
+}
+template <typename Tup>
+inline bool equal_tuple(const Tup &a, const Tup &b)
+{
+    return equal_tuple(
+        a, b, std::make_index_sequence<std::tuple_size_v<Tup>>());
+}
+
+template <typename T>
+inline const auto &key_of(const typename T::value_type &v)
+{
+    if constexpr (map_like_v<T>)
+    {
+        return v.first;
+    }
+    else
+    {
+        return v;
+    }
+}
+
+// Do not rely on operator== of containers and std::pair:
+// they compile for any element type, and fail deep inside for aggregates.
+template <typename T>
+inline bool equal(const T &a, const T &b)
+{
+    if constexpr (string_like_v<T>)
+    {
+        return a == b;
+    }
+    else if constexpr (iterable_v<T>)
+    {
+        if (std::size(a) != std::size(b))
+        {
+            return false;
+        }
+        if constexpr (unordered_assoc_v<T> && multi_key_v<T>)
+        {
+            auto eq = [](const auto &x, const auto &y) { return equal(x, y); };
+            // elements of a key are adjacent, walk a key at a time
+            for (auto ia = a.begin(); ia != a.end();)
+            {
+                auto ra = a.equal_range(key_of<T>(*ia));
+                auto rb = b.equal_range(key_of<T>(*ia));
+                if (!std::is_permutation(
+                        ra.first, ra.second, rb.first, rb.second, eq))
+                {
+                    return false;
+                }
+                ia = ra.second;
+            }
+            return true;
+        }
+        else if constexpr (unordered_assoc_v<T>)
+        {
+            for (const auto &v : a)
+            {
+                auto it = b.find(key_of<T>(v));
+                if (it == b.end() || !equal(v, *it))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+        else
+        {
+            auto ib = std::begin(b);
+            for (const auto &v : a)
+            {
+                if (!equal(v, *ib++))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    else if constexpr (tuple_like_v<T>)
+    {
+        return equal_tuple(a, b);
+    }
+    else if constexpr (optional_v<T>)
+    {
+        if (a.has_value() != b.has_value())
+        {
+            return false;
+        }
+        return !a.has_value() || equal(*a, *b);
+    }
+    else if constexpr (equality_comparable_v<T>)
+    {
+        return a == b;
+    }
+    else
+    {
+        static_assert(std::is_aggregate_v<T>,
+                      "pre_diff: T is neither comparable nor an aggregate");
+        return equal_tuple(fallback::as_tuple(a), fallback::as_tuple(b));
+    }
+}
+
+// Emit the list of changes, collapsing unchanged runs and obeying limit.
+class change_writer
+{
+public:
+    change_writer(std::ostream &os, ssize_t limit) : os_(os), limit_(limit)
+    {
+    }
+    void unchanged(size_t n = 1)
+    {
+        unchanged_ += n;
+    }
+    // Start a change. Return false if the limit is hit, and stop.
+    bool change()
+    {
+        if (stopped_)
+        {
+            return false;
+        }
+        flush_unchanged();
+        sep();
+        if (changes_ >= limit_)
+        {
+            os_ << "...";
+            stopped_ = true;
+            return false;
+        }
+        changes_++;
+        return true;
+    }
+    bool stopped() const
+    {
+        return stopped_;
+    }
+    void finish()
+    {
+        if (!stopped_)
+        {
+            flush_unchanged();
+        }
+    }
+
+private:
+    void sep()
+    {
+        if (!first_)
+        {
+            os_ << ", ";
+        }
+        first_ = false;
+    }
+    void flush_unchanged()
+    {
+        if (unchanged_)
+        {
+            sep();
+            os_ << "(" << unchanged_ << " unchanged)";
+            unchanged_ = 0;
+        }
+    }
+
+    std::ostream &os_;
+    ssize_t limit_;
+    ssize_t changes_{0};
+    size_t unchanged_{0};
+    bool first_{true};
+    bool stopped_{false};
+};
+
+template <typename T>
+void print(std::ostream &os, const T &a, const T &b, pre_ctx ctx);
+
+template <typename T>
+inline void print_leaf(std::ostream &os,
+                       const T &a,
+                       const T &b,
+                       const pre_ctx &ctx)
+{
+    if (equal(a, b))
+    {
+        os << "(unchanged)";
+    }
+    else
+    {
+        os << util::pre(a, ctx) << " -> " << util::pre(b, ctx);
+    }
+}
+
+template <typename Tup, size_t... I>
+inline void print_tuple(std::ostream &os,
+                        const Tup &a,
+                        const Tup &b,
+                        const pre_ctx &ctx,
+                        std::index_sequence<I...>)
+{
+    change_writer w(os, ctx.limit);
+    os << "<";
+    auto field = [&](size_t i, const auto &x, const auto &y)
+    {
+        if (equal(x, y))
+        {
+            w.unchanged();
+        }
+        else if (w.change())
+        {
+            os << "~#" << i << ": ";
+            print(os, x, y, ctx);
+        }
+    };
+    (..., field(I, std::get<I>(a), std::get<I>(b)));
+    w.finish();
+    os << ">";
+}
+template <typename Tup>
+inline void print_tuple(std::ostream &os,
+                        const Tup &a,
+                        const Tup &b,
+                        const pre_ctx &ctx)
+{
+    print_tuple(
+        os, a, b, ctx, std::make_index_sequence<std::tuple_size_v<Tup>>());
+}
+
+template <typename T>
+inline void print_added(std::ostream &os,
+                        const typename T::value_type &v,
+                        const pre_ctx &ctx)
+{
+    if constexpr (map_like_v<T>)
+    {
+        os << "+" << util::pre(v.first, ctx) << ": "
+           << util::pre(v.second, ctx);
+    }
+    else
+    {
+        os << "+" << util::pre(v, ctx);
+    }
+}
+template <typename T>
+inline void print_removed(std::ostream &os,
+                          const typename T::value_type &v,
+                          const pre_ctx &ctx)
+{
+    if constexpr (map_like_v<T>)
+    {
+        os << "-" << util::pre(v.first, ctx) << ": "
+           << util::pre(v.second, ctx);
+    }
+    else
+    {
+        os << "-" << util::pre(v, ctx);
+    }
+}
+// for maps only: keys are equal, mapped values may not
+template <typename T>
+inline void print_same_key(change_writer &w,
+                           std::ostream &os,
+                           const typename T::value_type &a,
+                           const typename T::value_type &b,
+                           const pre_ctx &ctx)
+{
+    if constexpr (map_like_v<T>)
+    {
+        if (!equal(a.second, b.second))
+        {
+            if (w.change())
+            {
+                os << "~" << util::pre(a.first, ctx) << ": ";
+                print(os, a.second, b.second, ctx);
+            }
+            return;
+        }
+    }
+    w.unchanged();
+}
+
+// linear merge along key_comp()
+template <typename T>
+inline void print_ordered(std::ostream &os,
+                          const T &a,
+                          const T &b,
+                          const pre_ctx &ctx)
+{
+    change_writer w(os, ctx.limit);
+    auto comp = a.key_comp();
+    auto ia = a.begin();
+    auto ib = b.begin();
+    os << "{";
+    while (!w.stopped() && (ia != a.end() || ib != b.end()))
+    {
+        if (ib == b.end() ||
+            (ia != a.end() && comp(key_of<T>(*ia), key_of<T>(*ib))))
+        {
+            if (w.change())
+            {
+                print_removed<T>(os, *ia, ctx);
+            }
+            ++ia;
+        }
+        else if (ia == a.end() || comp(key_of<T>(*ib), key_of<T>(*ia)))
+        {
+            if (w.change())
+            {
+                print_added<T>(os, *ib, ctx);
+            }
+            ++ib;
+        }
+        else
+        {
+            print_same_key<T>(w, os, *ia, *ib, ctx);
+            ++ia;
+            ++ib;
+        }
+    }
+    w.finish();
+    os << "}";
+}
+
+// multi-key containers: match the elements of each key of b pairwise with
+// those of a, the unmatched ones are added or removed
+template <typename T>
+inline void print_unordered_multi(change_writer &w,
+                                  std::ostream &os,
+                                  const T &a,
+                                  const T &b,
+                                  const pre_ctx &ctx)
+{
+    std::vector<bool> matched;
+    for (auto ib = b.begin(); ib != b.end() && !w.stopped();)
+    {
+        auto ra = a.equal_range(key_of<T>(*ib));
+        auto rb = b.equal_range(key_of<T>(*ib));
+        matched.assign(std::distance(ra.first, ra.second), false);
+        for (ib = rb.first; ib != rb.second && !w.stopped(); ++ib)
+        {
+            size_t i = 0;
+            auto ia = ra.first;
+            for (; ia != ra.second; ++ia, ++i)
+            {
+                if (!matched[i] && equal(*ia, *ib))
+                {
+                    break;
+                }
+            }
+            if (ia != ra.second)
+            {
+                matched[i] = true;
+                w.unchanged();
+            }
+            else if (w.change())
+            {
+                print_added<T>(os, *ib, ctx);
+            }
+        }
+        size_t i = 0;
+        for (auto ia = ra.first; ia != ra.second && !w.stopped(); ++ia, ++i)
+        {
+            if (!matched[i] && w.change())
+            {
+                print_removed<T>(os, *ia, ctx);
+            }
+        }
+        ib = rb.second;
+    }
+}
+
+// hash lookup of each key in the other side
+template <typename T>
+inline void print_unordered(std::ostream &os,
+                            const T &a,
+                            const T &b,
+                            const pre_ctx &ctx)
+{
+    change_writer w(os, ctx.limit);
+    os << "{";
+    if constexpr (multi_key_v<T>)
+    {
+        print_unordered_multi(w, os, a, b, ctx);
+    }
+    else
+    {
+        for (auto ib = b.begin(); ib != b.end() && !w.stopped(); ++ib)
+        {
+            auto ia = a.find(key_of<T>(*ib));
+            if (ia == a.end())
+            {
+                if (w.change())
+                {
+                    print_added<T>(os, *ib, ctx);
+                }
+            }
+            else
+            {
+                print_same_key<T>(w, os, *ia, *ib, ctx);
+            }
+        }
+    }
+    // keys only in a
+    for (auto ia = a.begin(); ia != a.end() && !w.stopped(); ++ia)
+    {
+        if (b.find(key_of<T>(*ia)) == b.end() && w.change())
+        {
+            print_removed<T>(os, *ia, ctx);
+        }
+    }
+    w.finish();
+    os << "}";
+}
+
+struct edit_op
+{
+    enum Kind
+    {
+        kEqual,
+        kDelete,
+        kInsert
+    };
+    Kind kind;
+    size_t i;  // index in before
+    size_t j;  // index in after
+};
+
+// Myers' O(ND) shortest edit script between a[0, n) and b[0, m).
+// Return false if the edit distance exceeds max_d, or if finding it takes
+// more than max_steps steps (diagonals visited plus element comparisons).
+template <typename It>
+inline bool myers(It a,
+                  size_t n,
+                  It b,
+                  size_t m,
+                  size_t max_d,
+                  size_t max_steps,
+                  std::vector<edit_op> &script)
+{
+    size_t steps = 0;
+    const ssize_t N = n;
+    const ssize_t M = m;
+    const ssize_t kMax = std::min<ssize_t>(N + M, max_d);
+    const ssize_t off = kMax + 1;
+    std::vector<ssize_t> v(2 * kMax + 3, 0);
+    std::vector<std::vector<ssize_t>> trace;
+    for (ssize_t d = 0; d <= kMax; ++d)
+    {
+        trace.push_back(v);
+        for (ssize_t k = -d; k <= d; k += 2)
+        {
+            if (++steps > max_steps)
+            {
+                return false;
+            }
+            ssize_t x;
+            if (k == -d || (k != d && v[off + k - 1] < v[off + k + 1]))
+            {
+                x = v[off + k + 1];
+            }
+            else
+            {
+                x = v[off + k - 1] + 1;
+            }
+            ssize_t y = x - k;
+            while (x < N && y < M)
+            {
+                if (++steps > max_steps)
+                {
+                    return false;
+                }
+                if (!equal(a[x], b[y]))
+                {
+                    break;
+                }
+                x++;
+                y++;
+            }
+            v[off + k] = x;
+            if (x >= N && y >= M)
+            {
+                // backtrack
+                x = N;
+                y = M;
+                for (ssize_t e = d; e > 0; --e)
+                {
+                    const auto &pv = trace[e];
+                    ssize_t kk = x - y;
+                    ssize_t prev_k;
+                    if (kk == -e ||
+                        (kk != e && pv[off + kk - 1] < pv[off + kk + 1]))
+                    {
+                        prev_k = kk + 1;
+                    }
+                    else
+                    {
+                        prev_k = kk - 1;
+                    }
+                    ssize_t prev_x = pv[off + prev_k];
+                    ssize_t prev_y = prev_x - prev_k;
+                    while (x > prev_x && y > prev_y)
+                    {
+                        x--;
+                        y--;
+                        script.push_back(
+                            {edit_op::kEqual, size_t(x), size_t(y)});
+                    }
+                    if (x == prev_x)
+                    {
+                        script.push_back(
+                            {edit_op::kInsert, size_t(x), size_t(prev_y)});
+                    }
+                    else
+                    {
+                        script.push_back(
+                            {edit_op::kDelete, size_t(prev_x), size_t(y)});
+                    }
+                    x = prev_x;
+                    y = prev_y;
+                }
+                while (x > 0 && y > 0)
+                {
+                    x--;
+                    y--;
+                    script.push_back({edit_op::kEqual, size_t(x), size_t(y)});
+                }
+                std::reverse(script.begin(), script.end());
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+template <typename It>
+inline void print_replaced(change_writer &w,
+                           std::ostream &os,
+                           It a,
+                           size_t i,
+                           It b,
+                           const pre_ctx &ctx)
+{
+    if (equal(*a, *b))
+    {
+        w.unchanged();
+    }
+    else if (w.change())
+    {
+        os << "~[" << i << "]: ";
+        print(os, *a, *b, ctx);
+    }
+}
+
+// Pair up the deletions and insertions between two equal runs as
+// replacements, so that "[1, 2, 3] -> [1, 5, 3]" shows "~[1]: 2 -> 5".
+template <typename It>
+inline void print_script(change_writer &w,
+                         std::ostream &os,
+                         It a,
+                         It b,
+                         const std::vector<edit_op> &script,
+                         const pre_ctx &ctx)
+{
+    size_t idx = 0;
+    while (idx < script.size() && !w.stopped())
+    {
+        if (script[idx].kind == edit_op::kEqual)
+        {
+            w.unchanged();
+            idx++;
+            continue;
+        }
+        size_t del_begin = idx;
+        while (idx < script.size() && script[idx].kind == edit_op::kDelete)
+        {
+            idx++;
+        }
+        size_t del_end = idx;
+        while (idx < script.size() && script[idx].kind == edit_op::kInsert)
+        {
+            idx++;
+        }
+        size_t ins_end = idx;
+        size_t dels = del_end - del_begin;
+        size_t ins = ins_end - del_end;
+        for (size_t k = 0; k < std::max(dels, ins) && !w.stopped(); ++k)
+        {
+            if (k < dels && k < ins)
+            {
+                const auto &d = script[del_begin + k];
+                const auto &in = script[del_end + k];
+                print_replaced(w, os, a + d.i, d.i, b + in.j, ctx);
+            }
+            else if (k < dels)
+            {
+                const auto &d = script[del_begin + k];
+                if (w.change())
+                {
+                    os << "-[" << d.i << "]: " << util::pre(a[d.i], ctx);
+                }
+            }
+            else if (w.change())
+            {
+                const auto &in = script[del_end + k];
+                os << "+[" << in.j << "]: " << util::pre(b[in.j], ctx);
+            }
+        }
+    }
+}
+
+// positional diff, also the fallback when the edit script is too long
+template <typename It>
+inline void print_positional(change_writer &w,
+                             std::ostream &os,
+                             It ia,
+                             It ea,
+                             It ib,
+                             It eb,
+                             size_t offset,
+                             const pre_ctx &ctx)
+{
+    size_t i = offset;
+    for (; ia != ea && ib != eb && !w.stopped(); ++ia, ++ib, ++i)
+    {
+        print_replaced(w, os, ia, i, ib, ctx);
+    }
+    for (size_t j = i; ia != ea && w.change(); ++ia, ++j)
+    {
+        os << "-[" << j << "]: " << util::pre(*ia, ctx);
+    }
+    for (size_t j = i; ib != eb && w.change(); ++ib, ++j)
+    {
+        os << "+[" << j << "]: " << util::pre(*ib, ctx);
+    }
+}
+
+template <typename T>
+inline void print_sequence(std::ostream &os,
+                           const T &a,
+                           const T &b,
+                           const pre_ctx &ctx)
+{
+    change_writer w(os, ctx.limit);
+    os << "[";
+    if constexpr (random_access_v<T>)
+    {
+        auto ia = std::begin(a);
+        auto ib = std::begin(b);
+        size_t n = std::size(a);
+        size_t m = std::size(b);
+        // the common prefix and suffix do not need an edit script
+        size_t prefix = 0;
+        while (prefix < n && prefix < m && equal(ia[prefix], ib[prefix]))
+        {
+            prefix++;
+        }
+        size_t suffix = 0;
+        while (suffix < n - prefix && suffix < m - prefix &&
+               equal(ia[n - 1 - suffix], ib[m - 1 - suffix]))
+        {
+            suffix++;
+        }
+        w.unchanged(prefix);
+        std::vector<edit_op> script;
+        if (myers(ia + prefix,
+                  n - prefix - suffix,
+                  ib + prefix,
+                  m - prefix - suffix,
+                  kMaxEditDistance,
+                  kMaxDiffSteps,
+                  script))
+        {
+            for (auto &op : script)
+            {
+                op.i += prefix;
+                op.j += prefix;
+            }
+            print_script(w, os, ia, ib, script, ctx);
+        }
+        else
+        {
+            print_positional(w,
+                             os,
+                             ia + prefix,
+                             ia + (n - suffix),
+                             ib + prefix,
+                             ib + (m - suffix),
+                             prefix,
+                             ctx);
+        }
+        w.unchanged(suffix);
+    }
+    else
+    {
+        print_positional(w,
+                         os,
+                         std::begin(a),
+                         std::end(a),
+                         std::begin(b),
+                         std::end(b),
+                         0,
+                         ctx);
+    }
+    w.finish();
+    os << "]";
+}
+
+template <typename T>
+inline void print(std::ostream &os, const T &a, const T &b, pre_ctx ctx)
+{
+    ctx.depth--;
+    if (ctx.depth < 0)
+    {
+        os << "...";
+        return;
+    }
+    if constexpr (string_like_v<T>)
+    {
+        print_leaf(os, a, b, ctx);
+    }
+    else if constexpr (iterable_v<T>)
+    {
+        if constexpr (unordered_assoc_v<T>)
+        {
+            print_unordered(os, a, b, ctx);
+        }
+        else if constexpr (ordered_assoc_v<T>)
+        {
+            print_ordered(os, a, b, ctx);
+        }
+        else
+        {
+            print_sequence(os, a, b, ctx);
+        }
+    }
+    else if constexpr (tuple_like_v<T>)
+    {
+        print_tuple(os, a, b, ctx);
+    }
+    else if constexpr (optional_v<T>)
+    {
+        if (a.has_value() && b.has_value() && !equal(*a, *b))
+        {
+            os << "some(";
+            print(os, *a, *b, ctx);
+            os << ")";
+        }
+        else
+        {
+            print_leaf(os, a, b, ctx);
+        }
+    }
+    else if constexpr (!ostreamable_v<T> && std::is_aggregate_v<T>)
+    {
+        os << "{" << names::get_type_name<T>() << " ";
+        print_tuple(os, fallback::as_tuple(a), fallback::as_tuple(b), ctx);
+        os << "}";
+    }
+    else
+    {
+        print_leaf(os, a, b, ctx);
+    }
+}
+}  // namespace diff
+
+template <typename T>
+class pre_diff
+{
+public:
+    pre_diff(const T &before, const T &after, const pre_ctx &ctx = {})
+        : before_(before), after_(after), ctx_(ctx)
+    {
+    }
+    const T &before() const
+    {
+        return before_;
+    }
+    const T &after() const
+    {
+        return after_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
+
+private:
+    const T &before_;
+    const T &after_;
+    pre_ctx ctx_;
+};
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const pre_diff<T> &d)
+{
+    diff::print(os, d.before(), d.after(), d.ctx());
+    return os;
+}
+
+// Streaming hash over the same structure pre traverses, see pre_if_changed.
+// Much cheaper than formatting: contiguous ranges of trivially comparable
+// elements are hashed as raw bytes in 32-byte stripes (as XXH64 does).
+namespace hashing
+{
+class hasher
+{
+public:
+    void update(const void *data, size_t len)
+    {
+        if (len == 0)
+        {
+            return;
+        }
+        const auto *p = static_cast<const unsigned char *>(data);
+        total_ += len;
+        if (buf_len_ + len < kStripe)
+        {
+            std::memcpy(buf_ + buf_len_, p, len);
+            buf_len_ += len;
+            return;
+        }
+        if (buf_len_)
+        {
+            size_t fill = kStripe - buf_len_;
+            std::memcpy(buf_ + buf_len_, p, fill);
+            stripe(buf_);
+            p += fill;
+            len -= fill;
+            buf_len_ = 0;
+        }
+        for (; len >= kStripe; p += kStripe, len -= kStripe)
+        {
+            stripe(p);
+        }
+        std::memcpy(buf_, p, len);
+        buf_len_ = len;
+    }
+    template <typename T>
+    void update_value(const T &v)
+    {
+        update(&v, sizeof(T));
+    }
+    uint64_t digest() const
+    {
+        uint64_t h;
+        if (total_ >= kStripe)
+        {
+            h = rotl(v_[0], 1) + rotl(v_[1], 7) + rotl(v_[2], 12) +
+                rotl(v_[3], 18);
+            for (auto v : v_)
+            {
+                h = (h ^ round(0, v)) * kPrime1 + kPrime4;
+            }
+        }
+        else
+        {
+            h = kPrime5;
+        }
+        h += total_;
+        size_t i = 0;
+        for (; i + 8 <= buf_len_; i += 8)
+        {
+            h ^= round(0, read64(buf_ + i));
+            h = rotl(h, 27) * kPrime1 + kPrime4;
+        }
+        for (; i < buf_len_; ++i)
+        {
+            h ^= buf_[i] * kPrime5;
+            h = rotl(h, 11) * kPrime1;
+        }
+        h ^= h >> 33;
+        h *= kPrime2;
+        h ^= h >> 29;
+        h *= kPrime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    constexpr static size_t kStripe = 32;
+    constexpr static uint64_t kPrime1 = 0x9E3779B185EBCA87ULL;
+    constexpr static uint64_t kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr static uint64_t kPrime3 = 0x165667B19E3779F9ULL;
+    constexpr static uint64_t kPrime4 = 0x85EBCA77C2B2AE63ULL;
+    constexpr static uint64_t kPrime5 = 0x27D4EB2F165667C5ULL;
+
+    static uint64_t rotl(uint64_t x, int r)
+    {
+        return (x << r) | (x >> (64 - r));
+    }
+    static uint64_t read64(const unsigned char *p)
+    {
+        uint64_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+    static uint64_t round(uint64_t acc, uint64_t input)
+    {
+        acc += input * kPrime2;
+        return rotl(acc, 31) * kPrime1;
+    }
+    void stripe(const unsigned char *p)
+    {
+        for (size_t i = 0; i < 4; ++i)
+        {
+            v_[i] = round(v_[i], read64(p + 8 * i));
+        }
+    }
+
+    uint64_t v_[4]{kPrime1 + kPrime2, kPrime2, 0, 0 - kPrime1};
+    unsigned char buf_[kStripe];
+    size_t buf_len_{0};
+    uint64_t total_{0};
+};
+
+// pre prints C strings by content, so they are hashed by content too
+template <typename T>
+auto constexpr char_ptr_v = std::is_same_v<std::remove_cv_t<T>, const char *> ||
+                            std::is_same_v<std::remove_cv_t<T>, char *>;
+
+template <typename T>
+constexpr bool raw_hashable();
+
+template <typename Tup, size_t... I>
+constexpr bool raw_hashable_fields(std::index_sequence<I...>)
+{
+    return (true && ... &&
+            raw_hashable<std::remove_cv_t<std::remove_reference_t<
+                std::tuple_element_t<I, Tup>>>>());
+}
+
+// elements whose bytes are the value, so contiguous ranges hash as memory
+template <typename T>
+constexpr bool raw_hashable()
+{
+    if constexpr (char_ptr_v<T>)
+    {
+        return false;
+    }
+    else if constexpr (std::is_arithmetic_v<T> || std::is_enum_v<T> ||
+                       std::is_pointer_v<T>)
+    {
+        return true;
+    }
+    else if constexpr (std::is_array_v<T>)
+    {
+        return raw_hashable<std::remove_extent_t<T>>();
+    }
+    else if constexpr (!std::has_unique_object_representations_v<T>)
+    {
+        return false;
+    }
+    else if constexpr (!ostreamable_v<T> && std::is_aggregate_v<T>)
+    {
+        // a C string field is printed by content
+        using Tup = decltype(fallback::as_tuple(std::declval<const T &>()));
+        return raw_hashable_fields<Tup>(
+            std::make_index_sequence<std::tuple_size_v<Tup>>());
+    }
+    else
+    {
+        return true;
+    }
+}
+
+template <typename T>
+auto constexpr raw_hashable_v = raw_hashable<T>();
+
+template <typename T, typename = void>
+auto constexpr contiguous_v = false;
+template <typename T>
+auto constexpr contiguous_v<
+    T,
+    std::void_t<decltype(std::data(std::declval<const T &>()))>> = true;
+
+template <typename T>
+auto constexpr adaptor_v = false;
+template <typename T, typename C>
+auto constexpr adaptor_v<std::queue<T, C>> = true;
+template <typename T, typename C>
+auto constexpr adaptor_v<std::stack<T, C>> = true;
+template <typename T, typename C, typename Cmp>
+auto constexpr adaptor_v<std::priority_queue<T, C, Cmp>> = true;
+
+template <typename T>
+auto constexpr atomic_v = false;
+template <typename T>
+auto constexpr atomic_v<std::atomic<T>> = true;
+
+template <typename T>
+auto constexpr smart_ptr_v = false;
+template <typename T>
+auto constexpr smart_ptr_v<std::shared_ptr<T>> = true;
+template <typename T, typename D>
+auto constexpr smart_ptr_v<std::unique_ptr<T, D>> = true;
+
+template <typename T>
+void hash(hasher &h, const T &t);
+
+template <typename Tup, size_t... I>
+inline void hash_tuple(hasher &h, const Tup &t, std::index_sequence<I...>)
+{
+    (..., hash(h, std::get<I>(t)));
+}
+
+template <typename T>
+inline void hash(hasher &h, const T &t)
+{
+    if constexpr (raw_hashable_v<T>)
+    {
+        h.update_value(t);
+    }
+    else if constexpr (char_ptr_v<T>)
+    {
+        h.update_value(t != nullptr);
+        if (t)
+        {
+            h.update(t, std::strlen(t));
+        }
+    }
+    else if constexpr (std::is_array_v<T> &&
+                       raw_hashable_v<std::remove_extent_t<T>>)
+    {
+        h.update(t, sizeof(T));
+    }
+    else if constexpr (iterable_v<T>)
+    {
+        using E = std::decay_t<decltype(*std::begin(t))>;
+        h.update_value(size_t(std::size(t)));
+        if constexpr (contiguous_v<T> && raw_hashable_v<E>)
+        {
+            h.update(std::data(t), std::size(t) * sizeof(E));
+        }
+        else if constexpr (unordered_assoc_v<T>)
+        {
+            // bucket order is not part of the content: combine commutatively
+            uint64_t sum = 0;
+            for (const auto &e : t)
+            {
+                hasher eh;
+                hash(eh, e);
+                sum += eh.digest();
+            }
+            h.update_value(sum);
+        }
+        else
+        {
+            for (const auto &e : t)
+            {
+                hash(h, e);
+            }
+        }
+    }
+    else if constexpr (diff::tuple_like_v<T>)
+    {
+        hash_tuple(h, t, std::make_index_sequence<std::tuple_size_v<T>>());
+    }
+    else if constexpr (diff::optional_v<T> || smart_ptr_v<T>)
+    {
+        bool has = bool(t);
+        h.update_value(has);
+        if (has)
+        {
+            hash(h, *t);
+        }
+    }
+    else if constexpr (atomic_v<T>)
+    {
+        hash(h, t.load(std::memory_order_relaxed));
+    }
+    else if constexpr (adaptor_v<T>)
+    {
+        hash(h, get_container(t));
+    }
+    else if constexpr (!ostreamable_v<T> && std::is_aggregate_v<T>)
+    {
+        auto tup = fallback::as_tuple(t);
+        hash_tuple(
+            h,
+            tup,
+            std::make_index_sequence<std::tuple_size_v<decltype(tup)>>());
+    }
+    else
+    {
+        // opaque to us: hash what operator<< produces
+        thread_local line_buf buf;
+        buf.clear();
+        std::ostream os(&buf);
+        os << util::pre(t);
+        h.update(buf.str().data(), buf.str().size());
+    }
+}
+
+template <typename T>
+inline uint64_t hash(const T &t)
+{
+    hasher h;
+    hash(h, t);
+    return h.digest();
+}
+
+struct change_state
+{
+    uint64_t hash;
+    std::chrono::steady_clock::time_point since;
+};
+
+// The last hash seen at one call site, see PRE_IF_CHANGED. Racing threads
+// may both see a change, which only prints the value twice.
+struct site_state
+{
+    std::atomic<uint64_t> hash{0};
+    // steady_clock ticks of the last change, 0 if never seen
+    std::atomic<int64_t> since{0};
+};
+
+inline bool update_state(site_state &state,
+                         uint64_t hash,
+                         std::chrono::steady_clock::time_point &since)
+{
+    auto now = std::chrono::steady_clock::now();
+    auto last = state.since.load(std::memory_order_relaxed);
+    if (last == 0 || state.hash.load(std::memory_order_relaxed) != hash)
+    {
+        state.hash.store(hash, std::memory_order_relaxed);
+        state.since.store(std::max<int64_t>(now.time_since_epoch().count(), 1),
+                          std::memory_order_relaxed);
+        since = now;
+        return true;
+    }
+    since = std::chrono::steady_clock::time_point(
+        std::chrono::steady_clock::duration(last));
+    return false;
+}
+
+// Return true if the hash of key differs from the last call.
+// Set since to the time of the last change.
+// Takes a global lock, call sites known at compile time use site_state.
+inline bool update_state(std::string_view key,
+                         uint64_t hash,
+                         std::chrono::steady_clock::time_point &since)
+{
+    static std::mutex mu;
+    static std::map<std::string, change_state, std::less<>> states;
+    auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lk(mu);
+    auto it = states.find(key);
+    if (it == states.end())
+    {
+        states.emplace(std::string(key), change_state{hash, now});
+        since = now;
+        return true;
+    }
+    if (it->second.hash != hash)
+    {
+        it->second = change_state{hash, now};
+        since = now;
+        return true;
+    }
+    since = it->second.since;
+    return false;
+}
+}  // namespace hashing
+
+// Print t only if its content changed since the last print under key.
+// Otherwise, print "(unchanged for N ms)".
+template <typename T>
+class pre_if_changed
+{
+public:
+    pre_if_changed(std::string_view key, const T &t, const pre_ctx &ctx = {})
+        : key_(key), t_(t), ctx_(ctx)
+    {
+    }
+    // keyed by state itself, without the lookup and lock of string keys
+    pre_if_changed(hashing::site_state &state,
+                   const T &t,
+                   const pre_ctx &ctx = {})
+        : state_(&state), t_(t), ctx_(ctx)
+    {
+    }
+    std::string_view key() const
+    {
+        return key_;
+    }
+    hashing::site_state *state() const
+    {
+        return state_;
+    }
+    const T &inner() const
+    {
+        return t_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
+
+private:
+    std::string_view key_;
+    hashing::site_state *state_ = nullptr;
+    const T &t_;
+    pre_ctx ctx_;
+};
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const pre_if_changed<T> &p)
+{
+    std::chrono::steady_clock::time_point since;
+    auto hash = hashing::hash(p.inner());
+    bool changed = p.state() ? hashing::update_state(*p.state(), hash, since)
+                             : hashing::update_state(p.key(), hash, since);
+    if (changed)
+    {
+        os << util::pre(p.inner(), p.ctx());
+    }
+    else
+    {
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                      std::chrono::steady_clock::now() - since)
+                      .count();
+        os << "(unchanged for " << ms << " ms)";
+    }
+    return os;
+}
+
+#define UP_STRINGIFY_IMPL(x) #x
+#define UP_STRINGIFY(x) UP_STRINGIFY_IMPL(x)
+// pre_if_changed keyed by the call site, with its state in a static
+#define PRE_IF_CHANGED(var)                                  \
+    util::pre_if_changed(                                    \
+        []() -> util::hashing::site_state &                  \
+        {                                                    \
+            static util::hashing::site_state up_site_state_; \
+            return up_site_state_;                           \
+        }(),                                                 \
+        var)
+
+// Columnar rendering of a sequence of aggregates or tuples, see pre_table.
+// Column widths are computed from the first kSampleRows rows only. Later
+// rows are streamed with those widths, so nothing is formatted twice.
+namespace table
+{
+constexpr static size_t kSampleRows = 64;
+
+template <typename E>
+inline auto fields_of(const E &e)
+{
+    if constexpr (diff::tuple_like_v<E>)
+    {
+        return std::apply([](const auto &...fs) { return std::tie(fs...); },
+                          e);
+    }
+    else
+    {
+        static_assert(std::is_aggregate_v<E>,
+                      "pre_table: elements must be aggregates or tuples");
+        return fallback::as_tuple(e);
+    }
+}
+
+class renderer
+{
+public:
+    renderer(std::ostream &os, size_t cols) : os_(os), cols_(cols + 1)
+    {
+    }
+    void header()
+    {
+        cell("#");
+        for (size_t i = 0; i + 1 < cols_; ++i)
+        {
+            cell(std::to_string(i));
+        }
+    }
+    void elided()
+    {
+        for (size_t i = 0; i < cols_; ++i)
+        {
+            cell("...");
+        }
+    }
+    template <typename E>
+    void row(size_t idx, const E &e, const pre_ctx &ctx)
+    {
+        cell(std::to_string(idx));
+        std::apply(
+            [this, &ctx](const auto &...fs)
+            {
+                (..., format(fs, ctx));
+            },
+            fields_of(e));
+    }
+    void finish()
+    {
+        if (!frozen_)
+        {
+            freeze();
+        }
+    }
+
+private:
+    template <typename F>
+    void format(const F &f, const pre_ctx &ctx)
+    {
+        buf_.clear();
+        std::ostream os(&buf_);
+        os << util::pre(f, ctx);
+        cell(buf_.str());
+    }
+    void cell(std::string_view c)
+    {
+        if (frozen_)
+        {
+            emit(c, col_++);
+            if (col_ == cols_)
+            {
+                col_ = 0;
+            }
+            return;
+        }
+        sample_.emplace_back(c);
+        if (sample_.size() == kSampleRows * cols_)
+        {
+            freeze();
+        }
+    }
+    void freeze()
+    {
+        widths_.assign(cols_, 0);
+        for (size_t i = 0; i < sample_.size(); ++i)
+        {
+            widths_[i % cols_] =
+                std::max(widths_[i % cols_], sample_[i].size());
+        }
+        frozen_ = true;
+        for (size_t i = 0; i < sample_.size(); ++i)
+        {
+            emit(sample_[i], i % cols_);
+        }
+        sample_.clear();
+    }
+    void emit(std::string_view c, size_t col)
+    {
+        if (col == 0)
+        {
+            os_ << '\n';
+            pad(widths_[0], c.size());
+            os_ << c;
+            return;
+        }
+        os_ << " | " << c;
+        if (col + 1 < cols_)
+        {
+            pad(widths_[col], c.size());
+        }
+    }
+    void pad(size_t width, size_t size)
+    {
+        for (; size < width; ++size)
+        {
+            os_ << ' ';
+        }
+    }
+
+    std::ostream &os_;
+    size_t cols_;
+    size_t col_{0};
+    bool frozen_{false};
+    std::vector<std::string> sample_;
+    std::vector<size_t> widths_;
+    line_buf buf_;
+};
+}  // namespace table
+
+template <typename T>
+class pre_table
+{
+public:
+    pre_table(const T &t, const pre_ctx &ctx = {}) : t_(t), ctx_(ctx)
+    {
+    }
+    const T &inner() const
+    {
+        return t_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
+
+private:
+    const T &t_;
+    pre_ctx ctx_;
+};
+
+// The type name, followed by the header and one line per row, e.g.,
+// Person
+// # | 0   | 1
+// 0 | "A" | 25
+// 1 | "B" | 30
+// Fields are named by their index, since C++ has no reflection.
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const pre_table<T> &t)
+{
+    using E = std::decay_t<decltype(*std::begin(t.inner()))>;
+    const auto &obj = t.inner();
+    auto ctx = t.ctx();
+    ctx.depth--;
+    // cells stay on one line
+    ctx.width = 0;
+
+    constexpr size_t cols =
+        std::tuple_size_v<decltype(table::fields_of(std::declval<E>()))>;
+    size_t obj_size = std::size(obj);
+    size_t start_size = obj_size;
+    size_t end_size = 0;
+    if (t.ctx().limit < ssize_t(obj_size))
+    {
+        start_size = (t.ctx().limit + 1) / 2;
+        end_size = t.ctx().limit - start_size;
+    }
+    size_t ommitted = obj_size - start_size - end_size;
+
+    os << names::get_type_name<E>();
+    if (t.ctx().human)
+    {
+        os << " (sz: " << obj_size << ", ommitted " << ommitted << ")";
+    }
+    table::renderer r(os, cols);
+    r.header();
+    auto front_iter = std::begin(obj);
+    for (size_t i = 0; i < start_size; ++i, ++front_iter)
+    {
+        r.row(i, *front_iter, ctx);
+    }
+    if (ommitted)
+    {
+        r.elided();
+    }
+    if (end_size)
+    {
+        auto back_iter = std::rbegin(obj);
+        std::advance(back_iter, end_size - 1);
+        for (size_t i = obj_size - end_size; i < obj_size; ++i, --back_iter)
+        {
+            r.row(i, *back_iter, ctx);
+        }
+    }
+    r.finish();
+    return os;
+}
+
+// printf-style formatting of one floating-point number into [first, last),
+// truncated if it does not fit. Floating-point std::to_chars would need
+// GCC 11 or macOS 13.3, snprintf works everywhere.
+inline char *format_float(char *first, char *last, const char *fmt, double v)
+{
+    ssize_t n = std::snprintf(first, last - first, fmt, v);
+    return first + std::clamp<ssize_t>(n, 0, last - first - 1);
+}
+
+// Aligned rows for rectangular numeric matrices, see pre_matrix.
+// [[ 1,   2, ...,  9],
+//  [10,  20, ..., 90],
+//  ...,
+//  [11, 101, ..., 99]]
+// Rows and columns are both elided by ctx.limit.
+namespace matrix
+{
+// Character types, int8_t and uint8_t included, print as characters
+// through pre, so they take the slow path to match it.
+template <typename T>
+auto constexpr fast_numeric_v =
+    std::is_arithmetic_v<T> && !std::is_same_v<T, bool> &&
+    !std::is_same_v<T, char> && !std::is_same_v<T, signed char> &&
+    !std::is_same_v<T, unsigned char>;
+
+// The shown cells are formatted once into one buffer, then padded.
+class cells
+{
+public:
+    template <typename T>
+    void add(const T &v, const pre_ctx &ctx)
+    {
+        if constexpr (fast_numeric_v<T>)
+        {
+            // no stream, same as the default ostream: "%g" is its format
+            char tmp[64];
+            char *end;
+            if constexpr (std::is_floating_point_v<T>)
+            {
+                end = format_float(tmp, tmp + sizeof(tmp), "%g", v);
+            }
+            else
+            {
+                end = std::to_chars(tmp, tmp + sizeof(tmp), v).ptr;
+            }
+            text_.append(tmp, end);
+        }
+        else
+        {
+            buf_.clear();
+            std::ostream os(&buf_);
+            os << util::pre(v, ctx);
+            text_.append(buf_.str());
+        }
+        size_t len = text_.size() - (ends_.empty() ? 0 : ends_.back());
+        width_ = std::max(width_, len);
+        ends_.push_back(text_.size());
+    }
+    void elided()
+    {
+        text_.append("...");
+        ends_.push_back(text_.size());
+    }
+    // the idx-th cell, right aligned
+    void emit(std::ostream &os, size_t idx) const
+    {
+        size_t begin = idx == 0 ? 0 : ends_[idx - 1];
+        std::string_view c(text_.data() + begin, ends_[idx] - begin);
+        if (c != "...")
+        {
+            for (size_t i = c.size(); i < width_; ++i)
+            {
+                os << ' ';
+            }
+        }
+        os << c;
+    }
+
+private:
+    std::string text_;
+    std::vector<size_t> ends_;
+    size_t width_{0};
+    line_buf buf_;
+};
+
+inline void split(size_t size, ssize_t limit, size_t &start, size_t &end)
+{
+    start = size;
+    end = 0;
+    if (limit < ssize_t(size))
+    {
+        start = (limit + 1) / 2;
+        end = limit - start;
+    }
+}
+
+// View must provide rows(), cols() and at(r, c).
+template <typename View>
+inline void print(std::ostream &os, const View &v, const pre_ctx &ctx)
+{
+    size_t row_start, row_end, col_start, col_end;
+    split(v.rows(), ctx.limit, row_start, row_end);
+    split(v.cols(), ctx.limit, col_start, col_end);
+    bool col_elided = col_start + col_end < v.cols();
+    size_t row_cells = col_start + col_end + (col_elided ? 1 : 0);
+
+    cells cs;
+    auto add_row = [&](size_t r)
+    {
+        for (size_t c = 0; c < col_start; ++c)
+        {
+            cs.add(v.at(r, c), ctx);
+        }
+        if (col_elided)
+        {
+            cs.elided();
+        }
+        for (size_t c = v.cols() - col_end; c < v.cols(); ++c)
+        {
+            cs.add(v.at(r, c), ctx);
+        }
+    };
+    for (size_t r = 0; r < row_start; ++r)
+    {
+        add_row(r);
+    }
+    for (size_t r = v.rows() - row_end; r < v.rows(); ++r)
+    {
+        add_row(r);
+    }
+
+    size_t shown_rows = row_start + row_end;
+    size_t idx = 0;
+    os << "[";
+    for (size_t r = 0; r < shown_rows; ++r)
+    {
+        if (r > 0)
+        {
+            os << ",\n ";
+        }
+        if (r == row_start && row_start + row_end < v.rows())
+        {
+            os << "...,\n ";
+        }
+        os << "[";
+        for (size_t c = 0; c < row_cells; ++c)
+        {
+            if (c > 0)
+            {
+                os << ", ";
+            }
+            cs.emit(os, idx++);
+        }
+        os << "]";
+    }
+    if (shown_rows == 0 && v.rows() > 0)
+    {
+        os << "...";
+    }
+    os << "]";
+    if (ctx.human)
+    {
+        os << " (shape: " << v.rows() << " x " << v.cols() << ")";
+    }
+}
+
+// Nested random-access containers, e.g., std::vector<std::vector<T>>,
+// T[M][N] and std::array<std::array<T, N>, M>
+template <typename T>
+struct nested_view
+{
+    const T &m;
+    size_t rows() const
+    {
+        return std::size(m);
+    }
+    size_t cols() const
+    {
+        return rows() == 0 ? 0 : std::size(*std::begin(m));
+    }
+    const auto &at(size_t r, size_t c) const
+    {
+        return std::begin(std::begin(m)[r])[c];
+    }
+    bool rectangular() const
+    {
+        for (const auto &row : m)
+        {
+            if (std::size(row) != cols())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// rows x cols elements from ptr, each row stride elements apart
+template <typename E>
+struct strided_view
+{
+    const E *ptr;
+    size_t rows_;
+    size_t cols_;
+    size_t stride;
+    size_t rows() const
+    {
+        return rows_;
+    }
+    size_t cols() const
+    {
+        return cols_;
+    }
+    const E &at(size_t r, size_t c) const
+    {
+        return ptr[r * stride + c];
+    }
+};
+
+template <typename View>
+struct printable
+{
+    View view;
+    pre_ctx ctx;
+};
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os,
+                                const printable<nested_view<T>> &p)
+{
+    if (p.view.rectangular())
+    {
+        print(os, p.view, p.ctx);
+    }
+    else
+    {
+        os << util::pre(p.view.m, p.ctx);
+    }
+    return os;
+}
+
+template <typename E>
+inline std::ostream &operator<<(std::ostream &os,
+                                const printable<strided_view<E>> &p)
+{
+    print(os, p.view, p.ctx);
+    return os;
+}
+}  // namespace matrix
+
+// Print a nested container as an aligned matrix.
+// Fallback to util::pre if its rows differ in size.
+template <typename T>
+inline auto pre_matrix(const T &m, const pre_ctx &ctx = {})
+{
+    return matrix::printable<matrix::nested_view<T>>{{m}, ctx};
+}
+
+// Print a raw strided buffer as an aligned matrix, without copying it.
+template <typename E>
+inline auto pre_matrix(const E *ptr,
+                       size_t rows,
+                       size_t cols,
+                       size_t stride,
+                       const pre_ctx &ctx = {})
+{
+    return matrix::printable<matrix::strided_view<E>>{
+        {ptr, rows, cols, stride}, ctx};
+}
+
+// Read the text printed by util::pre back into a value, e.g., to load
+// dumps of state as reproduction fixtures. The grammar is what the
+// printers above emit:
+// - numbers, true/false, 'c' and "string" (std::string_view targets
+//   point into the text)
+// - [a, b] for sequences, {a, b} for sets and {(k, v)} for maps
+// - (a, b) for pairs, <a, b> for tuples, {TypeName <a, b>} for aggregates
+// - some(a)/nullopt and atomic(a)
+// - bit strings of std::vector<bool> and std::bitset
+// Single pass: integers go through std::from_chars, floating-point numbers
+// through strtod on a bounded copy (C locale), and nothing is allocated
+// except by the target containers. Any whitespace separates tokens.
+// Elided ("...") or human output does not parse, nor do strings holding
+// a '"', since pre does not escape them.
+namespace parsing
+{
+class reader
+{
+public:
+    explicit reader(std::string_view s) : s_(s)
+    {
+    }
+    void skip_ws()
+    {
+        while (pos_ < s_.size() && std::isspace((unsigned char) s_[pos_]))
+        {
+            ++pos_;
+        }
+    }
+    bool done()
+    {
+        skip_ws();
+        return pos_ == s_.size();
+    }
+    char peek()
+    {
+        skip_ws();
+        return pos_ < s_.size() ? s_[pos_] : '\0';
+    }
+    bool eat(char c)
+    {
+        if (peek() != c)
+        {
+            return false;
+        }
+        ++pos_;
+        return true;
+    }
+    bool eat(std::string_view word)
+    {
+        skip_ws();
+        if (s_.substr(pos_, word.size()) != word)
+        {
+            return false;
+        }
+        pos_ += word.size();
+        return true;
+    }
+    // The next character as is, even a space or a quote
+    std::optional<char> get()
+    {
+        if (pos_ == s_.size())
+        {
+            return std::nullopt;
+        }
+        return s_[pos_++];
+    }
+    // Up to (excluding) the next delimiter or space
+    std::string_view token()
+    {
+        skip_ws();
+        size_t end = s_.find_first_of(" \t\r\n\v\f,)]}>", pos_);
+        end = end == std::string_view::npos ? s_.size() : end;
+        auto ret = s_.substr(pos_, end - pos_);
+        pos_ = end;
+        return ret;
+    }
+    // Up to (excluding) the next `c`, which is consumed
+    std::optional<std::string_view> until(char c)
+    {
+        size_t end = s_.find(c, pos_);
+        if (end == std::string_view::npos)
+        {
+            return std::nullopt;
+        }
+        auto ret = s_.substr(pos_, end - pos_);
+        pos_ = end + 1;
+        return ret;
+    }
+    // Skip the type name of an aggregate, up to the " <" of its fields
+    bool skip_type_name()
+    {
+        skip_ws();
+        int nested = 0;
+        for (; pos_ < s_.size(); ++pos_)
+        {
+            char c = s_[pos_];
+            if (nested == 0 && c == '<' && pos_ > 0 && s_[pos_ - 1] == ' ')
+            {
+                return true;
+            }
+            nested += c == '<' || c == '(';
+            nested -= c == '>' || c == ')';
+        }
+        return false;
+    }
+
+private:
+    std::string_view s_;
+    size_t pos_{0};
+};
+
+template <typename T, typename = void>
+auto constexpr emplace_back_v = false;
+template <typename T>
+auto constexpr emplace_back_v<
+    T,
+    std::void_t<decltype(std::declval<T &>().emplace_back())>> = true;
+
+template <typename T, typename = void>
+auto constexpr emplace_after_v = false;
+template <typename T>
+auto constexpr emplace_after_v<
+    T,
+    std::void_t<decltype(std::declval<T &>().emplace_after(
+        std::declval<T &>().before_begin()))>> = true;
+
+template <typename T>
+auto constexpr pair_v = false;
+template <typename T, typename U>
+auto constexpr pair_v<std::pair<T, U>> = true;
+
+template <typename T>
+auto constexpr bitset_v = false;
+template <size_t N>
+auto constexpr bitset_v<std::bitset<N>> = true;
+
+template <typename T>
+auto constexpr bool_vector_v = false;
+template <typename A>
+auto constexpr bool_vector_v<std::vector<bool, A>> = true;
+
+template <typename T>
+bool read(reader &r, T &t);
+
+// lb a, b, ... rb into the references of tup
+template <typename Tup>
+bool read_fields(reader &r, Tup &&tup, char lb, char rb)
+{
+    if (!r.eat(lb))
+    {
+        return false;
+    }
+    bool ok = std::apply(
+        [&](auto &...x)
+        {
+            size_t i = 0;
+            return (... && ((i++ == 0 || r.eat(',')) && read(r, x)));
+        },
+        std::forward<Tup>(tup));
+    return ok && r.eat(rb);
+}
+
+// One element of a container, appended to t
+template <typename T, typename Iter>
+bool read_element(reader &r, T &t, Iter &last)
+{
+    if constexpr (map_like_v<T>)
+    {
+        typename T::key_type k{};
+        typename T::mapped_type v{};
+        if (!read_fields(r, std::tie(k, v), '(', ')'))
+        {
+            return false;
+        }
+        t.emplace(std::move(k), std::move(v));
+    }
+    else if constexpr (associative_v<T>)
+    {
+        typename T::key_type k{};
+        if (!read(r, k))
+        {
+            return false;
+        }
+        t.insert(std::move(k));
+    }
+    else if constexpr (emplace_back_v<T>)
+    {
+        return read(r, t.emplace_back());
+    }
+    else if constexpr (emplace_after_v<T>)
+    {
+        last = t.emplace_after(last);
+        return read(r, *last);
+    }
+    else
+    {
+        // fixed size, e.g., std::array and C-style arrays
+        if (last == std::end(t))
+        {
+            return false;
+        }
+        return read(r, *last++);
+    }
+    return true;
+}
+
+template <typename T>
+bool read_container(reader &r, T &t)
+{
+    char lb = associative_v<T> ? '{' : '[';
+    char rb = associative_v<T> ? '}' : ']';
+    if (!r.eat(lb))
+    {
+        return false;
+    }
+    auto last = [&]()
+    {
+        if constexpr (emplace_after_v<T>)
+        {
+            t.clear();
+            return t.before_begin();
+        }
+        else if constexpr (emplace_back_v<T> || associative_v<T>)
+        {
+            t.clear();
+            return 0;
+        }
+        else
+        {
+            return std::begin(t);
+        }
+    }();
+    for (bool first = true; !r.eat(rb); first = false)
+    {
+        if ((!first && !r.eat(',')) || !read_element(r, t, last))
+        {
+            return false;
+        }
+    }
+    if constexpr (!emplace_after_v<T> && !emplace_back_v<T> &&
+                  !associative_v<T>)
+    {
+        return last == std::end(t);
+    }
+    return true;
+}
+
+template <typename T>
+bool read_bits(reader &r, T &t)
+{
+    auto digits = r.token();
+    if constexpr (bitset_v<T>)
+    {
+        if (digits.size() != t.size())
+        {
+            return false;
+        }
+        for (size_t i = 0; i < digits.size(); ++i)
+        {
+            // most significant bit first
+            t[digits.size() - 1 - i] = digits[i] == '1';
+        }
+    }
+    else
+    {
+        t.clear();
+        for (char d : digits)
+        {
+            t.push_back(d == '1');
+        }
+    }
+    return digits.find_first_not_of("01") == std::string_view::npos;
+}
+
+template <typename T>
+bool read(reader &r, T &t)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        if (r.eat("true"))
+        {
+            t = true;
+            return true;
+        }
+        t = false;
+        return r.eat("false");
+    }
+    else if constexpr (std::is_same_v<T, char>)
+    {
+        // exactly one character between the quotes, a quote included
+        if (!r.eat('\''))
+        {
+            return false;
+        }
+        auto c = r.get();
+        auto close = r.get();
+        if (!c || close != '\'')
+        {
+            return false;
+        }
+        t = *c;
+        return true;
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        // floating-point std::from_chars is missing from older libc++,
+        // strto* needs a NUL-terminated copy
+        auto token = r.token();
+        char buf[128];
+        if (token.empty() || token.size() >= sizeof(buf))
+        {
+            return false;
+        }
+        std::memcpy(buf, token.data(), token.size());
+        buf[token.size()] = '\0';
+        char *end = nullptr;
+        errno = 0;
+        if constexpr (std::is_same_v<T, float>)
+        {
+            t = std::strtof(buf, &end);
+        }
+        else if constexpr (std::is_same_v<T, double>)
+        {
+            t = std::strtod(buf, &end);
+        }
+        else
+        {
+            t = std::strtold(buf, &end);
+        }
+        return end == buf + token.size() && errno != ERANGE;
+    }
+    else if constexpr (std::is_arithmetic_v<T>)
+    {
+        auto token = r.token();
+        auto end = token.data() + token.size();
+        auto [ptr, ec] = std::from_chars(token.data(), end, t);
+        return ec == std::errc() && ptr == end;
+    }
+    else if constexpr (string_like_v<T>)
+    {
+        if (!r.eat('"'))
+        {
+            return false;
+        }
+        auto s = r.until('"');
+        if (s)
+        {
+            t = T(s->data(), s->size());
+        }
+        return s.has_value();
+    }
+    else if constexpr (diff::optional_v<T>)
+    {
+        if (r.eat("nullopt"))
+        {
+            t.reset();
+            return true;
+        }
+        return r.eat("some(") && read(r, t.emplace()) && r.eat(')');
+    }
+    else if constexpr (hashing::atomic_v<T>)
+    {
+        auto v = t.load(std::memory_order_relaxed);
+        bool ok = r.eat("atomic(") && read(r, v) && r.eat(')');
+        t.store(v, std::memory_order_relaxed);
+        return ok;
+    }
+    else if constexpr (pair_v<T>)
+    {
+        return read_fields(r, std::tie(t.first, t.second), '(', ')');
+    }
+    else if constexpr (diff::tuple_like_v<T>)
+    {
+        return read_fields(r, t, '<', '>');
+    }
+    else if constexpr (bitset_v<T> || bool_vector_v<T>)
+    {
+        return (bitset_v<T> || r.eat('[')) && read_bits(r, t) &&
+               (bitset_v<T> || r.eat(']'));
+    }
+    else if constexpr (iterable_v<T>)
+    {
+        return read_container(r, t);
+    }
+    else
+    {
+        static_assert(std::is_aggregate_v<T>, "pre_parse: unsupported type");
+        constexpr size_t n = fallback::count<T>();
+        return r.eat('{') && r.skip_type_name() &&
+               read_fields(r,
+                           fallback::as_tuple(
+                               t, std::integral_constant<size_t, n>{}),
+                           '<',
+                           '>') &&
+               r.eat('}');
+    }
+}
+}  // namespace parsing
+
+// Parse the output of util::pre back into t, in place.
+// Returns false unless text is exactly one value of T.
+template <typename T>
+bool pre_parse(std::string_view text, T &t)
+{
+    parsing::reader r(text);
+    return parsing::read(r, t) && r.done();
+}
+
+template <typename T>
+std::optional<T> pre_parse(std::string_view text)
+{
+    T t{};
+    if (!pre_parse(text, t))
+    {
+        return std::nullopt;
+    }
+    return t;
+}
+
+// Print a container page by page, e.g., to stream it to a client.
+// Each page continues where the previous one stopped, so a page of n
+// elements costs O(n), as long as the container is not modified in
+// between. Only the top level is paged, elements are printed with ctx.
+//   util::pre_cursor cursor(m);
+//   while (cursor.next_page(os, 100)) { ... }
+template <typename C>
+class pre_cursor
+{
+public:
+    pre_cursor(const C &c, const pre_ctx &ctx = {})
+        : c_(c), it_(std::begin(c)), ctx_(ctx)
+    {
+    }
+    // Print the next (at most) n elements as one list.
+    // Returns whether any element is left for the next page.
+    bool next_page(std::ostream &os, size_t n)
+    {
+        if (layout::unwrapped(os, ctx_))
+        {
+            layout::wrapper w(os, ctx_);
+            return next_page(w.os(), n);
+        }
+        size_t from = offset_;
+        auto end = std::end(c_);
+        layout::open(os, ctx_, associative_v<C> ? '{' : '[');
+        for (size_t i = 0; i < n && it_ != end; ++i, ++it_, ++offset_)
+        {
+            if (i)
+            {
+                layout::sep(os, ctx_, ',');
+            }
+            os << util::pre(*it_, ctx_);
+        }
+        layout::close(os, ctx_, associative_v<C> ? '}' : ']');
+        if (ctx_.human)
+        {
+            os << " (from: " << from;
+            if constexpr (sized_v<C>)
+            {
+                os << ", sz: " << std::size(c_);
+            }
+            os << ")";
+        }
+        return it_ != end;
+    }
+    // The number of elements printed so far
+    size_t offset() const
+    {
+        return offset_;
+    }
+    bool done() const
+    {
+        return it_ == std::end(c_);
+    }
+    // Start over, e.g., after the container is modified
+    void reset()
+    {
+        it_ = std::begin(c_);
+        offset_ = 0;
+    }
+
+private:
+    const C &c_;
+    decltype(std::begin(std::declval<const C &>())) it_;
+    size_t offset_{0};
+    pre_ctx ctx_;
+};
+
+// Estimated memory footprint of a value, following the same type dispatch
+// as util::pre. Heap bytes are counted recursively, with the node layout
+// of libstdc++ as the model:
+// - vector and string: capacity, string only out of its inline buffer
+// - deque: element blocks of 512 bytes and the block map
+// - list, forward_list, map, set: one node per element
+// - unordered containers: one node per element and the bucket array
+// - shared_ptr: control block and object, unique_ptr: object
+// - pair, tuple, optional, aggregates: their members
+// Types unknown to it, and non-owning views, own nothing.
+namespace memory
+{
+template <typename T, typename = void>
+auto constexpr allocator_aware_v = false;
+template <typename T>
+auto constexpr allocator_aware_v<T, std::void_t<typename T::allocator_type>> =
+    true;
+
+template <typename T, typename = void>
+auto constexpr capacity_v = false;
+template <typename T>
+auto constexpr capacity_v<
+    T,
+    std::void_t<decltype(std::declval<const T &>().capacity())>> = true;
+
+template <typename T>
+auto constexpr string_v = false;
+template <typename C, typename Traits, typename Alloc>
+auto constexpr string_v<std::basic_string<C, Traits, Alloc>> = true;
+
+template <typename T>
+auto constexpr aggregate_v = std::is_class_v<T> && std::is_aggregate_v<T>;
+
+template <typename T>
+using element_t = std::decay_t<decltype(*std::begin(std::declval<T &>()))>;
+
+constexpr static size_t kPtr = sizeof(void *);
+constexpr static size_t kDequeBlock = 512;
+
+// Bytes allocated by t itself, e.g., the nodes of a map, but not by its
+// elements.
+template <typename T>
+size_t storage(const T &t)
+{
+    if constexpr (string_v<T>)
+    {
+        auto self = reinterpret_cast<const char *>(&t);
+        auto data = reinterpret_cast<const char *>(t.data());
+        std::less<const char *> less;
+        bool inline_buf = !less(data, self) && less(data, self + sizeof(T));
+        return inline_buf ? 0 : (t.capacity() + 1) * sizeof(t[0]);
+    }
+    else if constexpr (std::is_same_v<T, std::vector<bool>>)
+    {
+        return (t.capacity() + 7) / 8;
+    }
+    else if constexpr (capacity_v<T>)
+    {
+        return t.capacity() * sizeof(element_t<T>);
+    }
+    else if constexpr (unordered_assoc_v<T>)
+    {
+        size_t node = kPtr + sizeof(size_t) + sizeof(element_t<T>);
+        return t.size() * node + t.bucket_count() * kPtr;
+    }
+    else if constexpr (ordered_assoc_v<T>)
+    {
+        size_t node = 4 * kPtr + sizeof(element_t<T>);
+        return t.size() * node;
+    }
+    else if constexpr (iterable_v<T> && allocator_aware_v<T>)
+    {
+        size_t e = sizeof(element_t<T>);
+        if constexpr (random_access_v<T>)
+        {
+            // std::deque
+            size_t per_block = e < kDequeBlock ? kDequeBlock / e : 1;
+            size_t blocks = t.size() / per_block + 1;
+            return blocks * per_block * e +
+                   std::max<size_t>(8, blocks + 2) * kPtr;
+        }
+        else if constexpr (sized_v<T>)
+        {
+            // std::list
+            return t.size() * (2 * kPtr + e);
+        }
+        else
+        {
+            // std::forward_list
+            size_t n = std::distance(std::begin(t), std::end(t));
+            return n * (kPtr + e);
+        }
+    }
+    else if constexpr (hashing::smart_ptr_v<T>)
+    {
+        using E = typename T::element_type;
+        if constexpr (std::is_array_v<E>)
+        {
+            return 0;  // the length is unknown
+        }
+        else if constexpr (std::is_same_v<T, std::shared_ptr<E>>)
+        {
+            return t ? 2 * kPtr + sizeof(E) : 0;
+        }
+        else
+        {
+            return t ? sizeof(E) : 0;
+        }
+    }
+    else
+    {
+        return 0;
+    }
+}
+
+template <typename T>
+size_t heap(const T &t);
+
+// Calls f(label, child) for the members or elements of t.
+// Elements of containers are labeled with nullptr.
+template <typename T, typename F>
+void for_each_child(const T &t, F &&f)
+{
+    if constexpr (string_like_v<T> || std::is_same_v<T, std::vector<bool>>)
+    {
+    }
+    else if constexpr (iterable_v<T>)
+    {
+        if constexpr (!std::is_trivially_copyable_v<element_t<const T>>)
+        {
+            for (const auto &e : t)
+            {
+                f(nullptr, e);
+            }
+        }
+    }
+    else if constexpr (hashing::adaptor_v<T>)
+    {
+        f("container", get_container(t));
+    }
+    else if constexpr (diff::optional_v<T> || hashing::smart_ptr_v<T>)
+    {
+        if constexpr (!std::is_array_v<typename T::element_type>)
+        {
+            if (t)
+            {
+                f("*", *t);
+            }
+        }
+    }
+    else if constexpr (diff::tuple_like_v<T> || aggregate_v<T>)
+    {
+        auto fields = [&]()
+        {
+            if constexpr (diff::tuple_like_v<T>)
+            {
+                return std::apply([](const auto &...x)
+                                  { return std::forward_as_tuple(x...); },
+                                  t);
+            }
+            else
+            {
+                return fallback::as_tuple(t);
+            }
+        }();
+        static constexpr const char *kLabels[] = {
+            "#0",  "#1",  "#2",  "#3",  "#4",  "#5",  "#6",  "#7",
+            "#8",  "#9",  "#10", "#11", "#12", "#13", "#14", "#15",
+            "#16", "#17", "#18", "#19", "#20", "#21", "#22", "#23",
+            "#24", "#25", "#26", "#27", "#28", "#29", "#30", "#31"};
+        static_assert(std::tuple_size_v<decltype(fields)> <=
+                          std::size(kLabels),
+                      "pre_mem labels at most 32 members");
+        std::apply(
+            [&](const auto &...x)
+            {
+                size_t i = 0;
+                (..., f(kLabels[i++], x));
+            },
+            fields);
+    }
+}
+
+// Heap bytes owned by t, recursively
+template <typename T>
+size_t heap(const T &t)
+{
+    size_t n = storage(t);
+    for_each_child(t,
+                   [&](const char *, const auto &child) { n += heap(child); });
+    return n;
+}
+
+inline void print_bytes(std::ostream &os, size_t n, bool human)
+{
+    if (!human || n < 1024)
+    {
+        os << n << " B";
+        return;
+    }
+    const char *units[] = {"KiB", "MiB", "GiB", "TiB"};
+    double v = n;
+    size_t u = 0;
+    for (v /= 1024; v >= 1024 && u + 1 < std::size(units); v /= 1024)
+    {
+        ++u;
+    }
+    char buf[32];
+    auto *end = format_float(buf, buf + sizeof(buf), "%.1f", v);
+    os.write(buf, end - buf) << ' ' << units[u];
+}
+
+// One line per node, members indented below their owner up to ctx.depth:
+// <label> <type>: <total> (heap <bytes>)
+// Returns the heap bytes of t. The members are rendered first, into a
+// buffer, so every subtree is measured once.
+template <typename T>
+size_t render(std::ostream &os,
+              const char *label,
+              const T &t,
+              ssize_t depth,
+              size_t indent,
+              const pre_ctx &ctx)
+{
+    size_t own = storage(t);
+    size_t children = 0;
+    size_t count = 0;
+    std::ostringstream members;
+    if constexpr (!iterable_v<T>)
+    {
+        if (depth > 0)
+        {
+            for_each_child(t,
+                           [&](const char *l, const auto &child)
+                           {
+                               members << "\n";
+                               children += render(members, l, child,
+                                                  depth - 1, indent + 2, ctx);
+                               ++count;
+                           });
+        }
+    }
+    if (!count)
+    {
+        for_each_child(t,
+                       [&](const char *, const auto &child)
+                       {
+                           children += heap(child);
+                           ++count;
+                       });
+    }
+    os << std::string(indent, ' ');
+    if (label)
+    {
+        os << label << " ";
+    }
+    os << names::get_type_name<T>() << ": ";
+    print_bytes(os, sizeof(T) + own + children, ctx.human);
+    os << " (heap ";
+    print_bytes(os, own + children, ctx.human);
+    os << ")";
+    if (depth <= 0)
+    {
+        return own + children;
+    }
+    if constexpr (iterable_v<T>)
+    {
+        // elements are summarized, one line for all of them
+        if (children)
+        {
+            os << "\n" << std::string(indent + 2, ' ') << "storage: ";
+            print_bytes(os, own, ctx.human);
+            os << "\n" << std::string(indent + 2, ' ') << "elements: ";
+            print_bytes(os, children, ctx.human);
+            os << " in " << count;
+        }
+    }
+    else
+    {
+        os << members.str();
+    }
+    return own + children;
+}
+
+template <typename T>
+class report
+{
+public:
+    report(const T &t, const pre_ctx &ctx) : t_(t), ctx_(ctx)
+    {
+    }
+    // sizeof(T) plus the heap bytes owned by it
+    size_t bytes() const
+    {
+        return sizeof(T) + heap(t_);
+    }
+    const T &inner() const
+    {
+        return t_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
+
+private:
+    const T &t_;
+    pre_ctx ctx_;
+};
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const report<T> &r)
+{
+    render(os, nullptr, r.inner(), r.ctx().depth, 0, r.ctx());
+    return os;
+}
+}  // namespace memory
+
+// The estimated memory footprint of t, see namespace memory.
+// bytes() is the total, printing it shows where the bytes are, with
+// members broken down to ctx.depth levels.
+template <typename T>
+inline auto pre_mem(const T &t, const pre_ctx &ctx = {})
+{
+    return memory::report<T>(t, ctx);
+}
+
+// Health of the hash table of an unordered container, e.g.,
+// std::unordered_map<int, int>
+// buckets: 13, size: 10, load_factor: 0.77, max_load_factor: 1.00
+// chain lengths: {0: 9, 2: 2, 3: 2}
+// longest chains: {#0: [52, 26, 0], #3: [42, 16, 29], #8: [34, 8]}
+// probe cost: expected 1.38, actual 1.80
+// Chain lengths map a length to its number of buckets. The probe cost is
+// the average number of nodes visited by a successful lookup, 1 + a/2
+// for a uniform hash with load factor a.
+namespace buckets
+{
+constexpr static size_t kLongest = 3;
+
+// The elements (keys for maps) of one bucket, through local iterators
+template <typename C>
+class bucket_view
+{
+public:
+    bucket_view(const C &c, size_t b) : c_(c), b_(b)
+    {
+    }
+    auto begin() const
+    {
+        return c_.begin(b_);
+    }
+    auto end() const
+    {
+        return c_.end(b_);
+    }
+
+private:
+    const C &c_;
+    size_t b_;
+};
+
+inline void print_fixed(std::ostream &os, double v)
+{
+    char buf[32];
+    auto *end = format_float(buf, buf + sizeof(buf), "%.2f", v);
+    os.write(buf, end - buf);
+}
+}  // namespace buckets
+
+template <typename C>
+class pre_buckets
+{
+public:
+    static_assert(unordered_assoc_v<C>, "needs an unordered container");
+    pre_buckets(const C &c, const pre_ctx &ctx = {}) : c_(c), ctx_(ctx)
+    {
+    }
+    const C &inner() const
+    {
+        return c_;
+    }
+    const pre_ctx &ctx() const
+    {
+        return ctx_;
+    }
+
+private:
+    const C &c_;
+    pre_ctx ctx_;
+};
+
+template <typename C>
+inline std::ostream &operator<<(std::ostream &os, const pre_buckets<C> &p)
+{
+    const auto &c = p.inner();
+    size_t bucket_count = c.bucket_count();
+
+    // one pass over the buckets
+    std::vector<size_t> lengths;
+    std::array<std::pair<size_t, size_t>, buckets::kLongest> longest{};
+    size_t probes = 0;
+    for (size_t b = 0; b < bucket_count; ++b)
+    {
+        size_t len = c.bucket_size(b);
+        if (len >= lengths.size())
+        {
+            lengths.resize(len + 1);
+        }
+        ++lengths[len];
+        probes += len * (len + 1) / 2;
+        if (len > longest.back().first)
+        {
+            longest.back() = {len, b};
+            std::sort(longest.begin(),
+                      longest.end(),
+                      [](const auto &x, const auto &y)
+                      { return x.first > y.first; });
+        }
+    }
+
+    os << names::get_type_name<C>() << "\n";
+    os << "buckets: " << bucket_count << ", size: " << c.size()
+       << ", load_factor: ";
+    buckets::print_fixed(os, c.load_factor());
+    os << ", max_load_factor: ";
+    buckets::print_fixed(os, c.max_load_factor());
+
+    os << "\nchain lengths: {";
+    const char *sep = "";
+    for (size_t len = 0; len < lengths.size(); ++len)
+    {
+        if (lengths[len])
+        {
+            os << sep << len << ": " << lengths[len];
+            sep = ", ";
+        }
+    }
+
+    os << "}\nlongest chains: {";
+    sep = "";
+    for (const auto &[len, b] : longest)
+    {
+        if (len < 2)
+        {
+            break;
+        }
+        buckets::bucket_view<C> bucket(c, b);
+        os << sep << "#" << b << ": ";
+        if constexpr (map_like_v<C>)
+        {
+            os << util::pre(views::transform_view(bucket, views::first_of{}),
+                            p.ctx());
+        }
+        else
+        {
+            os << util::pre(bucket, p.ctx());
+        }
+        sep = ", ";
+    }
+
+    os << "}\nprobe cost: expected ";
+    buckets::print_fixed(os, 1 + c.load_factor() / 2);
+    os << ", actual ";
+    buckets::print_fixed(os, c.size() ? double(probes) / c.size() : 0);
+    return os;
+}
+
+template <typename T>
+struct pre_with_name
+{
+    pre_with_name(const T &t, const char *n) : t_(t), name_(n)
+    {
+    }
+
+    const T &t_;
+    const char *name_;
+};
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const pre_with_name<T> &p)
+{
+    os << p.name_ << ": " << util::pre(p.t_);
+    return os;
+}
+
+// PRES(...) expands to a flat argument list of names, separators and values.
+// Hold them by const reference and print with a fold expression, so that no
+// heap allocation or type erasure is involved.
+template <typename T, typename... Ts>
+struct pre_with_names
+{
+    pre_with_names(const T &t, const Ts &...ts) : ts_(t, ts...)
+    {
+    }
+    std::tuple<const T &, const Ts &...> ts_;
+};
+
+template <typename T, typename... Ts>
+inline std::ostream &operator<<(std::ostream &os,
+                                const pre_with_names<T, Ts...> &p)
+{
+    pre_ctx ctx;
+    // C macro store the name as c_style_string,
+    // but we don't want to print the quote.
+    ctx.quote_string = false;
+
+    std::apply([&os, &ctx](const auto &...ts)
+               { (os << ... << util::pre(ts, ctx)); },
+               p.ts_);
+    return os;
 }
 
 #define PRE_STR(a) #a, ": ", a
-#define VA_NUM_ARGS(...) \
-    VA_NUM_ARGS_IMPL(__VA_ARGS__, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
-#define VA_NUM_ARGS_IMPL(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, N, ...) N
+// clang-format off
+#define VA_NUM_ARGS(...) VA_NUM_ARGS_IMPL(__VA_ARGS__, 32, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1)
+#define VA_NUM_ARGS_IMPL(_1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, _13, _14, _15, _16, _17, _18, _19, _20, _21, _22, _23, _24, _25, _26, _27, _28, _29, _30, _31, _32, N, ...) N
+
+#define CONCAT_IMPL(x, y) x##y
+#define MACRO_CONCAT(x, y) CONCAT_IMPL(x, y)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_1(a) PRE_STR(a)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_2(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_1(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_3(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_2(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_4(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_3(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_5(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_4(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_6(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_5(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_7(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_6(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_8(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_7(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_9(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_8(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_10(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_9(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_11(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_10(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_12(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_11(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_13(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_12(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_14(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_13(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_15(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_14(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_16(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_15(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_17(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_16(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_18(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_17(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_19(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_18(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_20(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_19(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_21(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_20(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_22(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_21(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_23(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_22(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_24(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_23(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_25(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_24(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_26(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_25(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_27(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_26(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_28(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_27(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_29(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_28(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_30(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_29(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_31(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_30(__VA_ARGS__)
+#define PREPEND_EACH_ARG_WITH_HASH_ARG_32(a, ...) PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_31(__VA_ARGS__)
+// clang-format on
+#define PREPEND_EACH_ARG_WITH_HASH_ARG(...)                                 \
+    MACRO_CONCAT(PREPEND_EACH_ARG_WITH_HASH_ARG_, VA_NUM_ARGS(__VA_ARGS__)) \
+    (__VA_ARGS__)
+
+#define NUMARGS(...) (sizeof((int[]){__VA_ARGS__}) / sizeof(int))
+
+namespace stats
+{
+// The cost of one instrumented call site. Sites link themselves into a
+// lock-free list on first use and are never removed.
+struct site
+{
+    explicit site(const char *where) : where(where)
+    {
+        auto &head = sites();
+        next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(next, this,
+                                           std::memory_order_release,
+                                           std::memory_order_relaxed))
+        {
+        }
+    }
+    static std::atomic<site *> &sites()
+    {
+        static std::atomic<site *> head{nullptr};
+        return head;
+    }
+    void record(uint64_t n_bytes, uint64_t n_elements, uint64_t n_ns)
+    {
+        calls.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n_bytes, std::memory_order_relaxed);
+        elements.fetch_add(n_elements, std::memory_order_relaxed);
+        ns.fetch_add(n_ns, std::memory_order_relaxed);
+    }
+
+    const char *where;
+    std::atomic<uint64_t> calls{0};
+    std::atomic<uint64_t> bytes{0};
+    std::atomic<uint64_t> elements{0};
+    std::atomic<uint64_t> ns{0};
+    site *next;
+};
+
+#ifdef UP_STATS
+// Forward to out, counting the bytes
+class counting_buf : public gather_buf
+{
+public:
+    // Counts what os writes, gathering into it if it gathers
+    explicit counting_buf(std::ostream &os)
+        : out_(os.rdbuf()),
+          target_(static_cast<gather_buf *>(os.pword(gather_buf::index())))
+    {
+    }
+    uint64_t count() const
+    {
+        return count_;
+    }
+    bool gathers() const
+    {
+        return target_ != nullptr;
+    }
+    bool gather(const char *data, size_t size) override
+    {
+        if (!target_ || !target_->gather(data, size))
+        {
+            return false;
+        }
+        count_ += size;
+        return true;
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            return traits_type::not_eof(ch);
+        }
+        auto ret = out_->sputc(traits_type::to_char_type(ch));
+        if (!traits_type::eq_int_type(ret, traits_type::eof()))
+        {
+            ++count_;
+        }
+        return ret;
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        auto ret = out_->sputn(s, n);
+        count_ += ret;
+        return ret;
+    }
+    int sync() override
+    {
+        return out_->pubsync();
+    }
+
+private:
+    std::streambuf *out_;
+    gather_buf *target_;
+    uint64_t count_ = 0;
+};
+
+// T formatted on behalf of a call site
+template <typename T>
+struct timed
+{
+    T t;
+    site &at;
+};
+
+template <typename T>
+inline timed<T> time_at(site &at, T t)
+{
+    return {std::move(t), at};
+}
+
+template <typename T>
+inline std::ostream &operator<<(std::ostream &os, const timed<T> &p)
+{
+    auto elements = tl_elements;
+    auto start = std::chrono::steady_clock::now();
+    auto elapsed = [&]()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now() - start)
+            .count();
+    };
+    // already laid out: a stream of its own would start a new layout
+    if (auto *lb = dynamic_cast<layout::layout_buf *>(os.rdbuf()))
+    {
+        size_t before = lb->written();
+        os << p.t;
+        p.at.record(lb->written() - before, tl_elements - elements,
+                    elapsed());
+        return os;
+    }
+    counting_buf buf(os);
+    std::ostream counted(&buf);
+    // flags, width and precision, and pword, which would point at os
+    counted.copyfmt(os);
+    counted.pword(gather_buf::index()) =
+        buf.gathers() ? static_cast<gather_buf *>(&buf) : nullptr;
+    counted << p.t;
+    p.at.record(buf.count(), tl_elements - elements, elapsed());
+    os.width(0);
+    if (!counted)
+    {
+        os.setstate(counted.rdstate());
+    }
+    return os;
+}
+#endif
+}  // namespace stats
+
+// Print the top instrumented call sites by cumulative time, one per line:
+//   main.cpp:42 calls: 3, bytes: 120, elements: 30, ns: 4500
+// Prints nothing unless UP_STATS is defined.
+inline void pre_stats_dump(std::ostream &os, size_t top = 10)
+{
+    std::vector<const stats::site *> all;
+    for (auto *s = stats::site::sites().load(std::memory_order_acquire); s;
+         s = s->next)
+    {
+        all.push_back(s);
+    }
+    auto ns = [](const stats::site *s)
+    { return s->ns.load(std::memory_order_relaxed); };
+    auto n = std::min(top, all.size());
+    std::partial_sort(all.begin(), all.begin() + n, all.end(),
+                      [&](const stats::site *a, const stats::site *b)
+                      { return ns(a) > ns(b); });
+    for (size_t i = 0; i < n; ++i)
+    {
+        const auto &s = *all[i];
+        os << s.where
+           << " calls: " << s.calls.load(std::memory_order_relaxed)
+           << ", bytes: " << s.bytes.load(std::memory_order_relaxed)
+           << ", elements: " << s.elements.load(std::memory_order_relaxed)
+           << ", ns: " << ns(&s) << '\n';
+    }
+}
+
+// Account the formatting of expr to this call site with UP_STATS, see
+// pre_stats_dump. PRE and PRES do so implicitly:
+//   std::cout << PRE_SITE(util::pre(vec)) << PRES(a, b);
+#ifdef UP_STATS
+#define PRE_SITE(expr)                                              \
+    util::stats::time_at(                                           \
+        []() -> util::stats::site &                                 \
+        {                                                           \
+            static util::stats::site s(__FILE__                     \
+                                       ":" UP_STRINGIFY(__LINE__)); \
+            return s;                                               \
+        }(),                                                        \
+        (expr))
+#else
+#define PRE_SITE(expr) (expr)
+#endif
+
+#define __UP_get_name(var) #var
+#define PRE(var) PRE_SITE(util::pre_with_name(var, __UP_get_name(var)))
+// PRES without accounting, usable in unevaluated contexts
+#define UP_PRES_RAW(...) \
+    util::pre_with_names(PREPEND_EACH_ARG_WITH_HASH_ARG(__VA_ARGS__))
+#define PRES(...) PRE_SITE(UP_PRES_RAW(__VA_ARGS__))
+
+// Format args... into the thread-local buffer, terminated by '\n', and call
+// emit(data, size) exactly once.
+// Re-entrant calls (e.g., from an operator<< of args) use a private buffer.
+template <typename F, typename... Ts>
+inline void pre_line_impl(F &&emit, const Ts &...args)
+{
+    constexpr static size_t kKeepCapacity = 1 << 20;
+    thread_local line_buf tl_buf;
+    thread_local std::ostream tl_os(&tl_buf);
+    thread_local bool tl_in_use = false;
+
+    auto format = [&](std::ostream &os, line_buf &buf)
+    {
+        pre_ctx ctx;
+        // labels are passed as C string, print them as is.
+        ctx.quote_string = false;
+        (os << ... << util::pre(args, ctx));
+        os << '\n';
+        emit(buf.str().data(), buf.str().size());
+    };
+
+    if (tl_in_use)
+    {
+        line_buf buf;
+        std::ostream os(&buf);
+        format(os, buf);
+        return;
+    }
+    // released even if formatting or emit throws
+    struct in_use_guard
+    {
+        explicit in_use_guard(bool &flag) : flag_(flag)
+        {
+            flag_ = true;
+        }
+        ~in_use_guard()
+        {
+            flag_ = false;
+        }
+        bool &flag_;
+    } guard(tl_in_use);
+    tl_buf.clear();
+    format(tl_os, tl_buf);
+    tl_buf.shrink(kKeepCapacity);
+}
+
+// write(2) all of data, retrying on EINTR and short writes.
+// Async-signal-safe.
+inline void write_all(int fd, const char *data, size_t size)
+{
+    while (size > 0)
+    {
+        auto ret = ::write(fd, data, size);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return;
+        }
+        data += ret;
+        size -= ret;
+    }
+}
+
+// Emit args... as one line with a single write(2).
+// Lines are not interleaved with other writers up to PIPE_BUF bytes.
+template <typename... Ts>
+inline void pre_line(int fd, const Ts &...args)
+{
+    pre_line_impl([fd](const char *data, size_t size)
+                  { write_all(fd, data, size); },
+                  args...);
+}
+
+// Emit args... as one line with a single fwrite, i.e., one lock of FILE.
+template <typename... Ts>
+inline void pre_line(FILE *file, const Ts &...args)
+{
+    pre_line_impl([file](const char *data, size_t size)
+                  { fwrite(data, 1, size, file); },
+                  args...);
+}
+
+// Emit args... as one line with a single ostream::write.
+template <typename... Ts>
+inline void pre_line(std::ostream &os, const Ts &...args)
+{
+    pre_line_impl([&os](const char *data, size_t size)
+                  { os.write(data, size); },
+                  args...);
+}
+
+// writev(2) all of iov[0, cnt), retrying on EINTR and short writes.
+// iov is consumed. Returns false on error.
+inline bool writev_all(int fd, struct iovec *iov, int cnt)
+{
+    while (cnt > 0)
+    {
+        auto ret = ::writev(fd, iov, std::min(cnt, IOV_MAX));
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        size_t done = ret;
+        while (cnt > 0 && done >= iov->iov_len)
+        {
+            done -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0)
+        {
+            iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+            iov->iov_len -= done;
+        }
+    }
+    return true;
+}
+
+// Sinks for bulk dumps, independent of stdio and of the small buffers of
+// std::cout. Both are std::streambufs with a large put area, so util::pre
+// formats straight into their memory:
+//   util::fd_sink sink(fd);
+//   sink.os() << util::pre(huge) << '\n';
+// Not thread-safe, use one per thread or pre_line with a lock.
+
+// Buffer up to bufsize bytes, then flush with writev(2). Writes that do
+// not fit go out in the same writev as the buffer, without a copy.
+//
+// With gather_threshold > 0, strings of at least that many bytes are not
+// copied either: brackets, separators and quotes go to the buffer and the
+// string is referenced by its own iovec. The strings must stay alive and
+// unchanged until the next flush, e.g., os().flush() or destruction:
+//   util::fd_sink sink(fd, 1 << 16, 4096);
+//   sink.os() << util::pre(documents) << std::flush;
+class fd_sink : public gather_buf
+{
+public:
+    explicit fd_sink(int fd, size_t bufsize = 1 << 20,
+                     size_t gather_threshold = 0)
+        : fd_(fd),
+          threshold_(gather_threshold),
+          buf_(std::max<size_t>(bufsize, 1)),
+          os_(this)
+    {
+        setp(buf_.data(), buf_.data() + buf_.size());
+        seg_ = pbase();
+        if (threshold_)
+        {
+            iov_.reserve(kIovBatch);
+            os_.pword(index()) = static_cast<gather_buf *>(this);
+        }
+    }
+    fd_sink(const fd_sink &) = delete;
+    fd_sink &operator=(const fd_sink &) = delete;
+    ~fd_sink() override
+    {
+        sync();
+    }
+    std::ostream &os()
+    {
+        return os_;
+    }
+    bool gather(const char *data, size_t size) override
+    {
+        if (!threshold_ || size < threshold_)
+        {
+            return false;
+        }
+        close_segment();
+        iov_.push_back({const_cast<char *>(data), size});
+        if (iov_.size() + 2 >= kIovBatch && !flush(nullptr, 0))
+        {
+            os_.setstate(std::ios::badbit);
+        }
+        return true;
+    }
+
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!flush(nullptr, 0))
+        {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        if (n <= epptr() - pptr())
+        {
+            std::memcpy(pptr(), s, n);
+            pbump(n);
+            return n;
+        }
+        return flush(s, n) ? n : 0;
+    }
+    int sync() override
+    {
+        return flush(nullptr, 0) ? 0 : -1;
+    }
+
+private:
+    // Gathered strings per writev before an early flush
+    static constexpr size_t kIovBatch = 64;
+
+    // End the buffer segment written since the last gathered string
+    void close_segment()
+    {
+        if (pptr() > seg_)
+        {
+            iov_.push_back({seg_, static_cast<size_t>(pptr() - seg_)});
+        }
+        seg_ = pptr();
+    }
+
+    // Write the buffer and gathered strings, then s, with a single writev
+    bool flush(const char *s, size_t n)
+    {
+        bool ok = true;
+        if (iov_.empty())
+        {
+            struct iovec iov[2] = {
+                {pbase(), static_cast<size_t>(pptr() - pbase())},
+                {const_cast<char *>(s), n}};
+            ok = writev_all(fd_, iov, n ? 2 : 1);
+        }
+        else
+        {
+            close_segment();
+            if (n)
+            {
+                iov_.push_back({const_cast<char *>(s), n});
+            }
+            ok = writev_all(fd_, iov_.data(), iov_.size());
+            iov_.clear();
+        }
+        setp(buf_.data(), buf_.data() + buf_.size());
+        seg_ = pbase();
+        return ok;
+    }
+
+    int fd_;
+    size_t threshold_;
+    std::vector<char> buf_;
+    std::vector<struct iovec> iov_;
+    char *seg_ = nullptr;
+    std::ostream os_;
+};
+
+// Format into a memory-mapped file, which grows by doubling. The file is
+// truncated to the bytes written on close() or destruction.
+class mmap_sink : public std::streambuf
+{
+public:
+    explicit mmap_sink(const char *path, size_t initial = 1 << 20)
+        : os_(this)
+    {
+        fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0 || !grow(std::max<size_t>(initial, 1)))
+        {
+            os_.setstate(std::ios::badbit);
+        }
+    }
+    mmap_sink(const mmap_sink &) = delete;
+    mmap_sink &operator=(const mmap_sink &) = delete;
+    ~mmap_sink() override
+    {
+        close();
+    }
+    std::ostream &os()
+    {
+        return os_;
+    }
+    bool ok() const
+    {
+        return fd_ >= 0 && base_ != nullptr;
+    }
+    // The number of bytes written so far
+    size_t size() const
+    {
+        return base_ ? pptr() - base_ : 0;
+    }
+    void close()
+    {
+        if (fd_ < 0)
+        {
+            return;
+        }
+        size_t used = size();
+        if (base_)
+        {
+            ::munmap(base_, cap_);
+            base_ = nullptr;
+        }
+        setp(nullptr, nullptr);
+        if (::ftruncate(fd_, used) != 0)
+        {
+            os_.setstate(std::ios::badbit);
+        }
+        ::close(fd_);
+        fd_ = -1;
+    }
 
-#define CONCAT_IMPL(x, y) x##y
-#define MACRO_CONCAT(x, y) CONCAT_IMPL(x, y)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_1(a) PRE_STR(a)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_2(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_1(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_3(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_2(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_4(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_3(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_5(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_4(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_6(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_5(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_7(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_6(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_8(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_7(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_9(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_8(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG_10(a, ...) \
-    PRE_STR(a), ", ", PREPEND_EACH_ARG_WITH_HASH_ARG_9(__VA_ARGS__)
-#define PREPEND_EACH_ARG_WITH_HASH_ARG(...)                                 \
-    MACRO_CONCAT(PREPEND_EACH_ARG_WITH_HASH_ARG_, VA_NUM_ARGS(__VA_ARGS__)) \
-    (__VA_ARGS__)
+protected:
+    int_type overflow(int_type ch) override
+    {
+        if (!ok() || !grow(cap_ * 2))
+        {
+            return traits_type::eof();
+        }
+        if (!traits_type::eq_int_type(ch, traits_type::eof()))
+        {
+            *pptr() = traits_type::to_char_type(ch);
+            pbump(1);
+        }
+        return traits_type::not_eof(ch);
+    }
+    std::streamsize xsputn(const char *s, std::streamsize n) override
+    {
+        if (n > epptr() - pptr() &&
+            (!ok() || !grow(std::max(cap_ * 2, size() + n))))
+        {
+            return 0;
+        }
+        std::memcpy(pptr(), s, n);
+        pbump(n);
+        return n;
+    }
 
-#define NUMARGS(...) (sizeof((int[]){__VA_ARGS__}) / sizeof(int))
+private:
+    // On failure the old mapping, and the bytes in it, are kept
+    bool grow(size_t cap)
+    {
+        size_t used = size();
+        if (::ftruncate(fd_, cap) != 0)
+        {
+            return false;
+        }
+        constexpr int kProt = PROT_READ | PROT_WRITE;
+        void *p = MAP_FAILED;
+#ifdef __linux__
+        p = base_ ? ::mremap(base_, cap_, cap, MREMAP_MAYMOVE)
+                  : ::mmap(nullptr, cap, kProt, MAP_SHARED, fd_, 0);
+#else
+        p = ::mmap(nullptr, cap, kProt, MAP_SHARED, fd_, 0);
+        if (p != MAP_FAILED && base_)
+        {
+            ::munmap(base_, cap_);
+        }
+#endif
+        if (p == MAP_FAILED)
+        {
+            return false;
+        }
+        base_ = static_cast<char *>(p);
+        cap_ = cap;
+        setp(base_, base_ + cap_);
+        // pbump takes an int
+        for (size_t left = used; left > 0;)
+        {
+            int step = std::min<size_t>(left, INT_MAX);
+            pbump(step);
+            left -= step;
+        }
+        return true;
+    }
 
-#define __UP_get_name(var) #var
-#define PRE(var) util::pre_with_name(var, __UP_get_name(var))
-#define PRES(...) \
-    util::pre_with_names(PREPEND_EACH_ARG_WITH_HASH_ARG(__VA_ARGS__))
+    int fd_{-1};
+    char *base_{nullptr};
+    size_t cap_{0};
+    std::ostream os_;
+};
+
+// Emit args... as one line into a streambuf, e.g., fd_sink or mmap_sink.
+template <typename... Ts>
+inline void pre_line(std::streambuf &sb, const Ts &...args)
+{
+    pre_line_impl([&sb](const char *data, size_t size)
+                  { sb.sputn(data, size); },
+                  args...);
+}
+
+// The last N records in a preallocated ring, each truncated to RecordSize
+// bytes, e.g., as UP_LOG_SINK for high-rate diagnostics that are only
+// written out when something goes wrong. Keep it in static storage.
+// Appending reserves a slot with one fetch_add, claims it with a CAS and
+// copies the record into it: no lock, no syscall and no allocation. A
+// slot is claimed by one writer or dump at a time, so records are never
+// torn. The rare record whose slot is still busy, being dumped or
+// written by a writer N records behind, is dropped.
+template <size_t N, size_t RecordSize = 256>
+class flight_recorder
+{
+public:
+    static_assert(N > 0 && RecordSize > 0, "needs room for records");
+
+    void append(const char *data, size_t size)
+    {
+        uint64_t seq = cursor_.fetch_add(1, std::memory_order_relaxed);
+        auto &slot = slots_[seq % N];
+        uint64_t mine = stamp(seq);
+        uint64_t state = slot.state.load(std::memory_order_relaxed);
+        do
+        {
+            if ((state & kBusy) || state >= mine)
+            {
+                return;
+            }
+        } while (!slot.state.compare_exchange_weak(state,
+                                                   mine | kBusy,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed));
+        if (size > RecordSize)
+        {
+            // truncated, but still a line
+            size = RecordSize;
+            std::memcpy(slot.data, data, size - 1);
+            slot.data[size - 1] = '\n';
+        }
+        else
+        {
+            std::memcpy(slot.data, data, size);
+        }
+        slot.size = size;
+        slot.state.store(mine, std::memory_order_release);
+    }
+
+    // The number of records appended so far, including overwritten ones
+    uint64_t count() const
+    {
+        return cursor_.load(std::memory_order_relaxed);
+    }
+
+    // Write the last N records, oldest first, with write(2) only.
+    // Async-signal-safe.
+    void dump(int fd) const
+    {
+        uint64_t end = cursor_.load(std::memory_order_acquire);
+        uint64_t begin = end > N ? end - N : 0;
+        for (uint64_t seq = begin; seq < end; ++seq)
+        {
+            auto &slot = slots_[seq % N];
+            uint64_t state = stamp(seq);
+            if (slot.state.compare_exchange_strong(state,
+                                                   state | kBusy,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed))
+            {
+                write_all(fd, slot.data, slot.size);
+                slot.state.store(state, std::memory_order_release);
+            }
+        }
+    }
+
+    // Dump to fd on SIGSEGV, SIGBUS, SIGFPE, SIGILL and SIGABRT, then die
+    // by the signal as before. One recorder per instantiation.
+    void dump_on_crash(int fd = STDERR_FILENO)
+    {
+        crash_fd_.store(fd, std::memory_order_relaxed);
+        crash_recorder_.store(this, std::memory_order_release);
+        struct sigaction sa = {};
+        sa.sa_handler = &flight_recorder::on_crash;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_RESETHAND;
+        for (int sig : {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT})
+        {
+            sigaction(sig, &sa, nullptr);
+        }
+    }
+
+private:
+    static void on_crash(int sig)
+    {
+        int saved_errno = errno;
+        if (auto *r = crash_recorder_.load(std::memory_order_acquire))
+        {
+            r->dump(crash_fd_.load(std::memory_order_relaxed));
+        }
+        errno = saved_errno;
+        // SA_RESETHAND restored the default action
+        raise(sig);
+    }
+
+    // The state of a slot holding record seq, without kBusy
+    static uint64_t stamp(uint64_t seq)
+    {
+        return (seq + 1) << 1;
+    }
+
+    constexpr static uint64_t kBusy = 1;
+
+    struct slot
+    {
+        // stamp() of the record in it, 0 if none, kBusy set while claimed
+        std::atomic<uint64_t> state{0};
+        size_t size{0};
+        char data[RecordSize];
+    };
+
+    std::atomic<uint64_t> cursor_{0};
+    mutable slot slots_[N];
+
+    static inline std::atomic<const flight_recorder *> crash_recorder_{
+        nullptr};
+    static inline std::atomic<int> crash_fd_{STDERR_FILENO};
+};
+
+// Append args... as one record.
+template <size_t N, size_t RecordSize, typename... Ts>
+inline void pre_line(flight_recorder<N, RecordSize> &recorder,
+                     const Ts &...args)
+{
+    pre_line_impl([&recorder](const char *data, size_t size)
+                  { recorder.append(data, size); },
+                  args...);
+}
+
+// A restricted util::pre for signal handlers: it formats into a caller
+// buffer and never allocates, locks or touches locales, i.e., no
+// std::ostream at all. Integers go through std::to_chars, floating-point
+// numbers are formatted by hand.
+// Supported: arithmetic types, chars, C strings, std::string(_view),
+// containers, pairs, tuples, optionals and aggregates, in the same format
+// as util::pre. Anything else prints as "?".
+namespace sigsafe
+{
+class writer
+{
+public:
+    writer(char *buf, size_t cap) : buf_(buf), cap_(cap)
+    {
+    }
+    void put(char c)
+    {
+        if (len_ < cap_)
+        {
+            buf_[len_++] = c;
+        }
+    }
+    void put(std::string_view s)
+    {
+        size_t n = std::min(s.size(), cap_ - len_);
+        std::memcpy(buf_ + len_, s.data(), n);
+        len_ += n;
+    }
+    template <typename N>
+    void number(N n)
+    {
+        char tmp[32];
+        char *end = tmp;
+        if constexpr (std::is_floating_point_v<N>)
+        {
+            end = format_general(tmp, n);
+        }
+        else
+        {
+            end = std::to_chars(tmp, tmp + sizeof(tmp), n).ptr;
+        }
+        size_t size = end - tmp;
+        if (size <= cap_ - len_)
+        {
+            std::memcpy(buf_ + len_, tmp, size);
+            len_ += size;
+        }
+        else
+        {
+            cap_ = len_;  // no room, and no partial number either
+        }
+    }
+    size_t size() const
+    {
+        return len_;
+    }
+
+private:
+    // v as std::ostream prints it by default, i.e., %g with 6 significant
+    // digits, by hand: floating-point std::to_chars is missing from some
+    // standard libraries and snprintf is not async-signal-safe.
+    static char *format_general(char *out, long double v)
+    {
+        if (v != v)
+        {
+            std::memcpy(out, "nan", 3);
+            return out + 3;
+        }
+        if (std::signbit(v))
+        {
+            *out++ = '-';
+            v = -v;
+        }
+        if (v > std::numeric_limits<long double>::max())
+        {
+            std::memcpy(out, "inf", 3);
+            return out + 3;
+        }
+        if (v == 0)
+        {
+            *out++ = '0';
+            return out;
+        }
+        // v = m * 10^(exp - 5) with 6 digits in m
+        int exp = 5;
+        for (; v >= 1e6L; v /= 10)
+        {
+            ++exp;
+        }
+        for (; v < 1e5L; v *= 10)
+        {
+            --exp;
+        }
+        auto m = static_cast<uint32_t>(v + 0.5L);
+        if (m >= 1000000)
+        {
+            m /= 10;
+            ++exp;
+        }
+        char digits[6];
+        for (int i = 5; i >= 0; --i, m /= 10)
+        {
+            digits[i] = '0' + m % 10;
+        }
+        int last = 5;  // without trailing zeros
+        for (; last > 0 && digits[last] == '0'; --last)
+        {
+        }
+        auto put_digits = [&](int from, int to)
+        {
+            for (int i = from; i <= to; ++i)
+            {
+                *out++ = digits[i];
+            }
+        };
+        if (exp >= -4 && exp < 6)
+        {
+            if (exp < 0)
+            {
+                *out++ = '0';
+                *out++ = '.';
+                for (int i = exp + 1; i < 0; ++i)
+                {
+                    *out++ = '0';
+                }
+                put_digits(0, last);
+            }
+            else
+            {
+                put_digits(0, exp);
+                if (last > exp)
+                {
+                    *out++ = '.';
+                    put_digits(exp + 1, last);
+                }
+            }
+            return out;
+        }
+        *out++ = digits[0];
+        if (last > 0)
+        {
+            *out++ = '.';
+            put_digits(1, last);
+        }
+        *out++ = 'e';
+        *out++ = exp < 0 ? '-' : '+';
+        exp = exp < 0 ? -exp : exp;
+        if (exp < 10)
+        {
+            *out++ = '0';
+        }
+        return std::to_chars(out, out + 8, exp).ptr;
+    }
+
+    char *buf_;
+    size_t cap_;
+    size_t len_{0};
+};
+
+template <typename T>
+void write(writer &w, const T &t, const pre_ctx &ctx);
+
+template <typename Tup>
+void write_fields(writer &w, const Tup &tup, const pre_ctx &ctx)
+{
+    std::apply(
+        [&](const auto &...x)
+        {
+            size_t i = 0;
+            (..., ((i++ ? w.put(", ") : void()), write(w, x, ctx)));
+        },
+        tup);
+}
+
+template <typename T>
+void write(writer &w, const T &t, const pre_ctx &ctx)
+{
+    if constexpr (std::is_same_v<T, bool>)
+    {
+        w.put(t ? "true" : "false");
+    }
+    else if constexpr (std::is_same_v<T, char>)
+    {
+        w.put('\'');
+        w.put(t);
+        w.put('\'');
+    }
+    else if constexpr (std::is_arithmetic_v<T>)
+    {
+        w.number(t);
+    }
+    else if constexpr (std::is_same_v<std::decay_t<T>, const char *> ||
+                       std::is_same_v<std::decay_t<T>, char *>)
+    {
+        const char *s = t;
+        w.put('"');
+        w.put(s ? std::string_view(s) : std::string_view());
+        w.put('"');
+    }
+    else if constexpr (string_like_v<T>)
+    {
+        w.put('"');
+        w.put(std::string_view(t.data(), t.size()));
+        w.put('"');
+    }
+    else if constexpr (diff::optional_v<T>)
+    {
+        if (t)
+        {
+            w.put("some(");
+            write(w, *t, ctx);
+            w.put(')');
+        }
+        else
+        {
+            w.put("nullopt");
+        }
+    }
+    else if constexpr (diff::tuple_like_v<T>)
+    {
+        bool pair = std::tuple_size_v<T> == 2 &&
+                    std::is_same_v<T, std::pair<std::tuple_element_t<0, T>,
+                                                std::tuple_element_t<1, T>>>;
+        w.put(pair ? '(' : '<');
+        write_fields(w, t, ctx);
+        w.put(pair ? ')' : '>');
+    }
+    else if constexpr (iterable_v<T>)
+    {
+        w.put(associative_v<T> ? '{' : '[');
+        ssize_t i = 0;
+        for (const auto &e : t)
+        {
+            if (i)
+            {
+                w.put(", ");
+            }
+            if (i++ == ctx.limit)
+            {
+                w.put("...");
+                break;
+            }
+            write(w, e, ctx);
+        }
+        w.put(associative_v<T> ? '}' : ']');
+    }
+    else if constexpr (std::is_class_v<T> && std::is_aggregate_v<T>)
+    {
+        w.put('{');
+        w.put(names::get_type_name<T>());
+        w.put(" <");
+        write_fields(w, fallback::as_tuple(t), ctx);
+        w.put(">}");
+    }
+    else
+    {
+        w.put('?');
+    }
+}
+}  // namespace sigsafe
+
+// Format t into buf like util::pre, truncated to cap bytes, and return the
+// number of bytes written. No terminating '\0' is written.
+// Async-signal-safe, e.g., to dump state from a SIGSEGV handler:
+//   char buf[512];
+//   write_all(STDERR_FILENO, buf, util::pre_sigsafe(buf, sizeof(buf), s));
+template <typename T>
+inline size_t pre_sigsafe(char *buf,
+                          size_t cap,
+                          const T &t,
+                          const pre_ctx &ctx = {})
+{
+    sigsafe::writer w(buf, cap);
+    sigsafe::write(w, t, ctx);
+    return w.size();
+}
+
+// Per call site sampling, see PRE_EVERY_N, PRE_FIRST_N and PRE_EVERY_MS.
+// Each call site owns its static state and only touches it with relaxed
+// atomics: we need rate limiting, not synchronization.
+namespace sampling
+{
+inline bool every_n(std::atomic<uint64_t> &cnt, uint64_t n)
+{
+    return n <= 1 || cnt.fetch_add(1, std::memory_order_relaxed) % n == 0;
+}
+
+inline bool first_n(std::atomic<uint64_t> &cnt, uint64_t n)
+{
+    // load first, so that the counter stops growing once saturated
+    return cnt.load(std::memory_order_relaxed) < n &&
+           cnt.fetch_add(1, std::memory_order_relaxed) < n;
+}
+
+inline bool every_ms(std::atomic<int64_t> &next_ns, int64_t ms)
+{
+    auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+                   .count();
+    auto next = next_ns.load(std::memory_order_relaxed);
+    if (now < next)
+    {
+        return false;
+    }
+    // only the winner of the race prints
+    return next_ns.compare_exchange_strong(
+        next, now + ms * 1000 * 1000, std::memory_order_relaxed);
+}
+}  // namespace sampling
+
+// The sink of the PRE_* logging macros. Override by defining it in advance.
+#ifndef UP_LOG_SINK
+#define UP_LOG_SINK std::cout
+#endif
+
+// Emit PRES(...) as a line to UP_LOG_SINK if cond holds.
+// Arguments are neither evaluated nor formatted otherwise.
+#define PRE_IF(cond, ...)                                   \
+    do                                                      \
+    {                                                       \
+        if (cond)                                           \
+        {                                                   \
+            util::pre_line(UP_LOG_SINK, PRES(__VA_ARGS__)); \
+        }                                                   \
+    } while (0)
+
+#define PRE_EVERY_N(n, ...)                                              \
+    do                                                                   \
+    {                                                                    \
+        static std::atomic<uint64_t> up_site_cnt_{0};                    \
+        PRE_IF(util::sampling::every_n(up_site_cnt_, (n)), __VA_ARGS__); \
+    } while (0)
+
+#define PRE_FIRST_N(n, ...)                                              \
+    do                                                                   \
+    {                                                                    \
+        static std::atomic<uint64_t> up_site_cnt_{0};                    \
+        PRE_IF(util::sampling::first_n(up_site_cnt_, (n)), __VA_ARGS__); \
+    } while (0)
+
+#define PRE_EVERY_MS(ms, ...)                                    \
+    do                                                           \
+    {                                                            \
+        static std::atomic<int64_t> up_site_next_ns_{0};         \
+        PRE_IF(util::sampling::every_ms(up_site_next_ns_, (ms)), \
+               __VA_ARGS__);                                     \
+    } while (0)
+
+// Severity levels of PRE_<LEVEL>(var) and PRES_<LEVEL>(...).
+// - Below UP_MIN_LEVEL (compile time), the macros vanish. The arguments are
+//   only referenced in an unevaluated context.
+// - Below util::log_level() (runtime), the cost is one relaxed load and a
+//   branch.
+#define UP_LEVEL_TRACE 0
+#define UP_LEVEL_DEBUG 1
+#define UP_LEVEL_INFO 2
+#define UP_LEVEL_WARN 3
+#define UP_LEVEL_ERROR 4
+
+#ifndef UP_MIN_LEVEL
+#define UP_MIN_LEVEL UP_LEVEL_TRACE
+#endif
+
+inline std::atomic<int> &log_level()
+{
+    static std::atomic<int> level{UP_LEVEL_TRACE};
+    return level;
+}
+inline void set_log_level(int level)
+{
+    log_level().store(level, std::memory_order_relaxed);
+}
+inline bool log_enabled(int level)
+{
+    return level >= log_level().load(std::memory_order_relaxed);
+}
+
+#define UP_PRES_AT(level, ...) PRE_IF(util::log_enabled(level), __VA_ARGS__)
+#define UP_PRES_NOTHING(...)                     \
+    do                                           \
+    {                                            \
+        (void) sizeof(UP_PRES_RAW(__VA_ARGS__)); \
+    } while (0)
+
+#if UP_MIN_LEVEL <= UP_LEVEL_TRACE
+#define PRES_TRACE(...) UP_PRES_AT(UP_LEVEL_TRACE, __VA_ARGS__)
+#else
+#define PRES_TRACE(...) UP_PRES_NOTHING(__VA_ARGS__)
+#endif
+#define PRE_TRACE(var) PRES_TRACE(var)
+
+#if UP_MIN_LEVEL <= UP_LEVEL_DEBUG
+#define PRES_DEBUG(...) UP_PRES_AT(UP_LEVEL_DEBUG, __VA_ARGS__)
+#else
+#define PRES_DEBUG(...) UP_PRES_NOTHING(__VA_ARGS__)
+#endif
+#define PRE_DEBUG(var) PRES_DEBUG(var)
+
+#if UP_MIN_LEVEL <= UP_LEVEL_INFO
+#define PRES_INFO(...) UP_PRES_AT(UP_LEVEL_INFO, __VA_ARGS__)
+#else
+#define PRES_INFO(...) UP_PRES_NOTHING(__VA_ARGS__)
+#endif
+#define PRE_INFO(var) PRES_INFO(var)
+
+#if UP_MIN_LEVEL <= UP_LEVEL_WARN
+#define PRES_WARN(...) UP_PRES_AT(UP_LEVEL_WARN, __VA_ARGS__)
+#else
+#define PRES_WARN(...) UP_PRES_NOTHING(__VA_ARGS__)
+#endif
+#define PRE_WARN(var) PRES_WARN(var)
+
+#if UP_MIN_LEVEL <= UP_LEVEL_ERROR
+#define PRES_ERROR(...) UP_PRES_AT(UP_LEVEL_ERROR, __VA_ARGS__)
+#else
+#define PRES_ERROR(...) UP_PRES_NOTHING(__VA_ARGS__)
+#endif
+#define PRE_ERROR(var) PRES_ERROR(var)
 
 }  // namespace util
 
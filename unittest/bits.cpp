@@ -0,0 +1,72 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+TEST(Bits, VectorBool)
+{
+    std::vector<bool> v{true, false, true, true, false};
+    EXPECT_EQ(util::pre_str(v), "[10110]");
+    EXPECT_EQ(util::pre_str(std::vector<bool>{}), "[]");
+
+    util::pre_ctx ctx;
+    ctx.limit = 3;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre(v, ctx)),
+              "[10...0] (sz: 5, ommitted 2)");
+}
+TEST(Bits, VectorBoolAcrossWords)
+{
+    std::vector<bool> v(200);
+    v[0] = v[64] = v[199] = true;
+    std::string expected(200, '0');
+    expected[0] = expected[64] = expected[199] = '1';
+    EXPECT_EQ(util::pre_str(v), "[" + expected + "]");
+
+    util::pre_ctx ctx;
+    ctx.limit = 4;
+    EXPECT_EQ(util::pre_str(util::pre(v, ctx)), "[10...01]");
+}
+TEST(Bits, Bitset)
+{
+    std::bitset<5> b(0b10110);
+    EXPECT_EQ(util::pre_str(b), "10110");
+    std::bitset<130> big;
+    big.set(0);
+    big.set(129);
+    EXPECT_EQ(util::pre_str(big), big.to_string());
+
+    util::pre_ctx ctx;
+    ctx.limit = 4;
+    EXPECT_EQ(util::pre_str(util::pre(big, ctx)), "10...01");
+}
+TEST(Bits, SetBits)
+{
+    std::vector<bool> v(300);
+    for (size_t i : {0, 1, 2, 3, 8, 10, 11})
+    {
+        v[i] = true;
+    }
+    for (size_t i = 60; i < 200; ++i)
+    {
+        v[i] = true;
+    }
+    EXPECT_EQ(util::pre_str(util::pre_set_bits(v)),
+              "{0-3, 8, 10-11, 60-199}");
+
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre_set_bits(v, ctx)),
+              "{0-3, 8, ...} (sz: 300, set: 147)");
+
+    std::bitset<100> b;
+    b.set(5);
+    b.set(99);
+    EXPECT_EQ(util::pre_str(util::pre_set_bits(b)), "{5, 99}");
+    EXPECT_EQ(util::pre_str(util::pre_set_bits(std::bitset<8>{})), "{}");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
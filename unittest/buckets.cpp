@@ -0,0 +1,79 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct ConstantHash
+{
+    size_t operator()(int) const
+    {
+        return 42;
+    }
+};
+
+// the lines of the report after the type name
+template <typename C>
+std::string report(const C &c, const util::pre_ctx &ctx = {})
+{
+    auto text = util::pre_str(util::pre_buckets(c, ctx));
+    return text.substr(text.find('\n') + 1);
+}
+
+TEST(Buckets, Degenerate)
+{
+    std::unordered_set<int, ConstantHash> s;
+    s.rehash(8);
+    for (int i = 0; i < 4; ++i)
+    {
+        s.insert(i);
+    }
+    size_t b = s.bucket(0);
+    auto text = report(s);
+    EXPECT_NE(text.find("chain lengths: {0: " +
+                        std::to_string(s.bucket_count() - 1) + ", 4: 1}"),
+              std::string::npos)
+        << text;
+    EXPECT_NE(text.find("longest chains: {#" + std::to_string(b) + ": ["),
+              std::string::npos)
+        << text;
+    // 1 + 2 + 3 + 4 nodes for 4 lookups
+    EXPECT_NE(text.find(", actual 2.50"), std::string::npos) << text;
+}
+TEST(Buckets, Map)
+{
+    std::unordered_map<int, std::string, ConstantHash> m{{1, "a"}, {2, "b"}};
+    util::pre_ctx ctx;
+    ctx.limit = 1;
+    auto text = report(m, ctx);
+    // keys only, elided by ctx
+    bool found = text.find(": [1, ...]}") != std::string::npos ||
+                 text.find(": [2, ...]}") != std::string::npos;
+    EXPECT_TRUE(found) << text;
+}
+TEST(Buckets, Healthy)
+{
+    std::unordered_set<int> s;
+    for (int i = 0; i < 5; ++i)
+    {
+        s.insert(i);
+    }
+    auto text = report(s);
+    EXPECT_EQ(text.find("buckets: " + std::to_string(s.bucket_count()) +
+                        ", size: 5, load_factor: "),
+              0)
+        << text;
+    // std::hash<int> is the identity, one element per bucket
+    EXPECT_NE(text.find("longest chains: {}"), std::string::npos) << text;
+    EXPECT_NE(text.find(", actual 1.00"), std::string::npos) << text;
+}
+TEST(Buckets, Empty)
+{
+    std::unordered_map<int, int> m;
+    auto text = report(m);
+    EXPECT_NE(text.find("size: 0"), std::string::npos) << text;
+    EXPECT_NE(text.find("actual 0.00"), std::string::npos) << text;
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
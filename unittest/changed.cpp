@@ -0,0 +1,85 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct Route
+{
+    int dst;
+    std::string via;
+};
+
+TEST(Changed, Vector)
+{
+    std::vector<int> vec{1, 2, 3};
+    EXPECT_EQ(util::pre_str(util::pre_if_changed("vec", vec)), "[1, 2, 3]");
+    EXPECT_EQ(util::pre_str(util::pre_if_changed("vec", vec)).rfind(
+                  "(unchanged for ", 0),
+              0);
+    vec.push_back(4);
+    EXPECT_EQ(util::pre_str(util::pre_if_changed("vec", vec)),
+              "[1, 2, 3, 4]");
+}
+TEST(Changed, Keys)
+{
+    std::vector<int> vec{1, 2, 3};
+    EXPECT_EQ(util::pre_str(util::pre_if_changed("a", vec)), "[1, 2, 3]");
+    EXPECT_EQ(util::pre_str(util::pre_if_changed("b", vec)), "[1, 2, 3]");
+}
+TEST(Changed, Aggregate)
+{
+    std::map<int, Route> table{{1, Route{1, "eth0"}}};
+    auto print = [&table]() { return util::pre_str(PRE_IF_CHANGED(table)); };
+    EXPECT_EQ(print(), "{(1, {Route <1, \"eth0\">})}");
+    EXPECT_NE(print().find("unchanged"), std::string::npos);
+    table[1].via = "eth1";
+    EXPECT_EQ(print(), "{(1, {Route <1, \"eth1\">})}");
+}
+TEST(Changed, CString)
+{
+    char buf[] = "abc";
+    const char *str = buf;
+    auto print = [&str]() { return util::pre_str(PRE_IF_CHANGED(str)); };
+    EXPECT_EQ(print(), util::pre_str(util::pre(str)));
+    EXPECT_NE(print().find("unchanged"), std::string::npos);
+    // same address, new content
+    buf[0] = 'x';
+    EXPECT_EQ(print(), util::pre_str(util::pre(str)));
+
+    struct Named
+    {
+        const char *name;
+    };
+    Named n{buf};
+    auto before = util::hashing::hash(n);
+    buf[1] = 'y';
+    EXPECT_NE(util::hashing::hash(n), before);
+    // different addresses, same content
+    char copy[] = "xyc";
+    EXPECT_EQ(util::hashing::hash(std::vector<const char *>{buf}),
+              util::hashing::hash(std::vector<const char *>{copy}));
+}
+TEST(Changed, Hash)
+{
+    std::unordered_set<int> a;
+    std::unordered_set<int> b;
+    for (int i = 0; i < 100; ++i)
+    {
+        a.insert(i);
+        b.insert(99 - i);
+    }
+    EXPECT_EQ(util::hashing::hash(a), util::hashing::hash(b));
+
+    std::vector<std::string> s1{"ab", "c"};
+    std::vector<std::string> s2{"a", "bc"};
+    EXPECT_NE(util::hashing::hash(s1), util::hashing::hash(s2));
+    std::vector<int> v1(1000, 1);
+    std::vector<int> v2(1000, 1);
+    EXPECT_EQ(util::hashing::hash(v1), util::hashing::hash(v2));
+    v2[999] = 2;
+    EXPECT_NE(util::hashing::hash(v1), util::hashing::hash(v2));
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,64 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+template <typename Cursor>
+std::string page(Cursor &cursor, size_t n, bool *more = nullptr)
+{
+    std::stringstream ss;
+    bool ret = cursor.next_page(ss, n);
+    if (more)
+    {
+        *more = ret;
+    }
+    return ss.str();
+}
+
+TEST(Cursor, Pages)
+{
+    std::vector<int> vec{1, 2, 3, 4, 5};
+    util::pre_cursor cursor(vec);
+    bool more = false;
+    EXPECT_EQ(page(cursor, 2, &more), "[1, 2]");
+    EXPECT_TRUE(more);
+    EXPECT_EQ(page(cursor, 2, &more), "[3, 4]");
+    EXPECT_TRUE(more);
+    EXPECT_EQ(page(cursor, 2, &more), "[5]");
+    EXPECT_FALSE(more);
+    EXPECT_TRUE(cursor.done());
+    EXPECT_EQ(cursor.offset(), 5);
+    EXPECT_EQ(page(cursor, 2, &more), "[]");
+
+    cursor.reset();
+    EXPECT_EQ(page(cursor, 10), "[1, 2, 3, 4, 5]");
+}
+TEST(Cursor, NodeBased)
+{
+    std::map<int, std::vector<int>> m{{1, {1}}, {2, {2, 2}}, {3, {}}};
+    util::pre_cursor cursor(m);
+    EXPECT_EQ(page(cursor, 2), "{(1, [1]), (2, [2, 2])}");
+    EXPECT_EQ(page(cursor, 2), "{(3, [])}");
+
+    std::forward_list<int> fl{1, 2, 3};
+    util::pre_cursor fl_cursor(fl);
+    EXPECT_EQ(page(fl_cursor, 2), "[1, 2]");
+    EXPECT_EQ(page(fl_cursor, 2), "[3]");
+}
+TEST(Cursor, Ctx)
+{
+    std::vector<std::vector<int>> nested{{1, 2, 3}, {4, 5, 6}, {7}};
+    util::pre_ctx ctx;
+    ctx.limit = 1;
+    ctx.human = true;
+    util::pre_cursor cursor(nested, ctx);
+    // only the top level is paged, ctx applies to the elements
+    EXPECT_EQ(page(cursor, 2),
+              "[[1, ...] (sz: 3, ommitted 2), [4, ...] (sz: 3, ommitted 2)] "
+              "(from: 0, sz: 3)");
+    EXPECT_EQ(page(cursor, 2), "[[7] (sz: 1, ommitted 0)] (from: 2, sz: 3)");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
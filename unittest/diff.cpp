@@ -0,0 +1,135 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct Point
+{
+    int x;
+    int y;
+    std::vector<int> tags;
+};
+
+TEST(Diff, Leaf)
+{
+    EXPECT_EQ(util::pre_str(util::pre_diff(1, 2)), "1 -> 2");
+    EXPECT_EQ(util::pre_str(util::pre_diff(1, 1)), "(unchanged)");
+    std::string a = "a";
+    std::string b = "b";
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)), "\"a\" -> \"b\"");
+}
+TEST(Diff, Vector)
+{
+    std::vector<int> a{1, 2, 3, 4, 5, 6};
+    std::vector<int> b{1, 2, 9, 4, 5, 6, 7};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)),
+              "[(2 unchanged), ~[2]: 3 -> 9, (3 unchanged), +[6]: 7]");
+
+    std::vector<int> c{0, 1, 2, 3, 4, 5, 6};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, c)),
+              "[+[0]: 0, (6 unchanged)]");
+    std::vector<int> d{1, 2, 4, 5, 6};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, d)),
+              "[(2 unchanged), -[2]: 3, (3 unchanged)]");
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, a)), "[(6 unchanged)]");
+}
+TEST(Diff, List)
+{
+    std::list<int> a{1, 2, 3};
+    std::list<int> b{1, 5, 3, 4};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)),
+              "[(1 unchanged), ~[1]: 2 -> 5, (1 unchanged), +[3]: 4]");
+}
+TEST(Diff, Map)
+{
+    std::map<int, std::string> a{{1, "a"}, {2, "b"}, {3, "c"}, {4, "d"}};
+    std::map<int, std::string> b{{1, "a"}, {2, "x"}, {4, "d"}, {5, "e"}};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)),
+              "{(1 unchanged), ~2: \"b\" -> \"x\", -3: \"c\", (1 unchanged), "
+              "+5: \"e\"}");
+
+    std::set<int> s1{1, 2, 3};
+    std::set<int> s2{2, 3, 4};
+    EXPECT_EQ(util::pre_str(util::pre_diff(s1, s2)),
+              "{-1, (2 unchanged), +4}");
+}
+TEST(Diff, UnorderedMap)
+{
+    std::unordered_map<int, int> a{{1, 1}, {2, 2}};
+    std::unordered_map<int, int> b{{2, 3}};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)), "{~2: 2 -> 3, -1: 1}");
+}
+TEST(Diff, UnorderedMulti)
+{
+    std::unordered_multimap<int, int> a{{1, 1}, {1, 2}, {2, 2}};
+    std::unordered_multimap<int, int> b{{1, 2}, {1, 1}, {2, 2}};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)), "{(3 unchanged)}");
+    b = {{1, 2}, {1, 3}, {3, 3}};
+    auto d = util::pre_str(util::pre_diff(a, b));
+    EXPECT_NE(d.find("+1: 3"), std::string::npos) << d;
+    EXPECT_NE(d.find("-1: 1"), std::string::npos) << d;
+    EXPECT_NE(d.find("+3: 3"), std::string::npos) << d;
+    EXPECT_NE(d.find("-2: 2"), std::string::npos) << d;
+    EXPECT_EQ(d.find("1: 2"), std::string::npos) << d;
+
+    std::unordered_multiset<int> sa{1, 1, 2};
+    std::unordered_multiset<int> sb{1, 2, 2};
+    EXPECT_EQ(util::pre_str(util::pre_diff(sa, sa)), "{(3 unchanged)}");
+    d = util::pre_str(util::pre_diff(sa, sb));
+    EXPECT_NE(d.find("+2"), std::string::npos) << d;
+    EXPECT_NE(d.find("-1"), std::string::npos) << d;
+}
+TEST(Diff, Aggregate)
+{
+    Point a{1, 2, {1, 2}};
+    Point b{1, 3, {1, 2, 3}};
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b)),
+              "{Point <(1 unchanged), ~#1: 2 -> 3, ~#2: [(2 unchanged), +[2]: "
+              "3]>}");
+
+    std::vector<Point> va{a, a};
+    std::vector<Point> vb{a, b};
+    EXPECT_EQ(util::pre_str(util::pre_diff(va, vb)),
+              "[(1 unchanged), ~[1]: {Point <(1 unchanged), ~#1: 2 -> 3, ~#2: "
+              "[(2 unchanged), +[2]: 3]>}]");
+}
+TEST(Diff, Limit)
+{
+    std::vector<int> a{1, 2, 3, 4};
+    std::vector<int> b{5, 6, 7, 8};
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b, ctx)),
+              "[~[0]: 1 -> 5, ~[1]: 2 -> 6, ...]");
+}
+TEST(Diff, LongEditScript)
+{
+    std::vector<int> a(2000);
+    std::vector<int> b(2000);
+    for (size_t i = 0; i < a.size(); ++i)
+    {
+        a[i] = i;
+        b[i] = i % 2 ? i : -i - 1;
+    }
+    util::pre_ctx ctx;
+    ctx.limit = 1;
+    EXPECT_EQ(util::pre_str(util::pre_diff(a, b, ctx)),
+              "[~[0]: 0 -> -1, (1 unchanged), ...]");
+}
+TEST(Diff, StepBudget)
+{
+    // a short edit script that is expensive to find: the comparisons are
+    // bounded, and the diff falls back to positional
+    std::vector<std::vector<int>> a(100000, std::vector<int>(1, 0));
+    std::vector<std::vector<int>> b = a;
+    a.front() = {1};
+    b.back() = {1};
+    util::pre_ctx ctx;
+    ctx.limit = 1;
+    auto d = util::pre_str(util::pre_diff(a, b, ctx));
+    EXPECT_EQ(d.substr(0, 10), "[~[0]: [~[") << d;
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,57 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+template <typename T>
+std::string layout_str(const T &t, ssize_t width)
+{
+    util::pre_ctx ctx;
+    ctx.width = width;
+    std::stringstream ss;
+    ss << util::pre(t, ctx);
+    return ss.str();
+}
+
+TEST(Layout, Fits)
+{
+    std::vector<int> vec{1, 2, 3};
+    EXPECT_EQ(layout_str(vec, 80), "[1, 2, 3]");
+    EXPECT_EQ(layout_str(vec, 9), "[1, 2, 3]");
+}
+TEST(Layout, Breaks)
+{
+    std::vector<int> vec{1, 2, 3};
+    EXPECT_EQ(layout_str(vec, 8), "[\n    1,\n    2,\n    3\n]");
+}
+TEST(Layout, Nested)
+{
+    std::map<int, std::vector<int>> m{{1, {1, 2, 3}}, {2, {}}};
+    EXPECT_EQ(layout_str(m, 80), "{(1, [1, 2, 3]), (2, [])}");
+    EXPECT_EQ(layout_str(m, 20),
+              "{\n"
+              "    (1, [1, 2, 3]),\n"
+              "    (2, [])\n"
+              "}");
+    EXPECT_EQ(layout_str(m, 17),
+              "{\n"
+              "    (\n"
+              "        1,\n"
+              "        [1, 2, 3]\n"
+              "    ),\n"
+              "    (2, [])\n"
+              "}");
+}
+TEST(Layout, Elision)
+{
+    std::vector<int> vec(100, 7);
+    util::pre_ctx ctx;
+    ctx.width = 10;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre(vec, ctx)),
+              "[\n    7,\n    ...,\n    7\n]");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,54 @@
+#include <sstream>
+
+std::stringstream &test_sink()
+{
+    static std::stringstream ss;
+    return ss;
+}
+#define UP_LOG_SINK test_sink()
+#define UP_MIN_LEVEL UP_LEVEL_DEBUG
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+std::string take_sink()
+{
+    auto ret = test_sink().str();
+    test_sink().str("");
+    return ret;
+}
+
+TEST(Levels, CompileTime)
+{
+    int evaluated = 0;
+    PRES_TRACE(++evaluated);
+    PRE_TRACE(evaluated);
+    EXPECT_EQ(take_sink(), "");
+    EXPECT_EQ(evaluated, 0);
+
+    PRES_DEBUG(++evaluated);
+    PRE_ERROR(evaluated);
+    EXPECT_EQ(take_sink(), "++evaluated: 1\nevaluated: 1\n");
+}
+TEST(Levels, Runtime)
+{
+    int evaluated = 0;
+    util::set_log_level(UP_LEVEL_WARN);
+    PRES_DEBUG(++evaluated);
+    PRES_INFO(++evaluated);
+    EXPECT_EQ(take_sink(), "");
+    EXPECT_EQ(evaluated, 0);
+
+    PRES_WARN(++evaluated);
+    EXPECT_EQ(take_sink(), "++evaluated: 1\n");
+
+    util::set_log_level(UP_LEVEL_TRACE);
+    PRES_INFO(evaluated);
+    EXPECT_EQ(take_sink(), "evaluated: 1\n");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
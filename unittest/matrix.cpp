@@ -0,0 +1,68 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+TEST(Matrix, Nested)
+{
+    std::vector<std::vector<int>> m{{1, 2, 3}, {10, 200, -3}};
+    EXPECT_EQ(util::pre_str(util::pre_matrix(m)),
+              "[[  1,   2,   3],\n"
+              " [ 10, 200,  -3]]");
+
+    int c_array[2][2] = {{1, 2}, {3, 4}};
+    EXPECT_EQ(util::pre_str(util::pre_matrix(c_array)), "[[1, 2],\n [3, 4]]");
+
+    std::array<std::array<double, 2>, 2> a{{{0.5, 1}, {1.0 / 3, 2}}};
+    EXPECT_EQ(util::pre_str(util::pre_matrix(a)),
+              "[[     0.5,        1],\n"
+              " [0.333333,        2]]");
+}
+TEST(Matrix, SameAsPre)
+{
+    // cells read the same as util::pre of the element
+    std::vector<std::vector<int8_t>> bytes{{'a', 'b'}};
+    EXPECT_EQ(util::pre_str(util::pre_matrix(bytes)),
+              "[[" + util::pre_str(util::pre(bytes[0][0])) + ", " +
+                  util::pre_str(util::pre(bytes[0][1])) + "]]");
+
+    for (double v : {1e-7, 123456789.0, -2.5, 0.1})
+    {
+        std::vector<std::vector<double>> cell{{v}};
+        EXPECT_EQ(util::pre_str(util::pre_matrix(cell)),
+                  "[[" + util::pre_str(util::pre(v)) + "]]");
+    }
+}
+TEST(Matrix, NotRectangular)
+{
+    std::vector<std::vector<int>> m{{1, 2, 3}, {1}};
+    EXPECT_EQ(util::pre_str(util::pre_matrix(m)), "[[1, 2, 3], [1]]");
+}
+TEST(Matrix, Elision)
+{
+    std::vector<std::vector<int>> m(10, std::vector<int>(10));
+    for (size_t i = 0; i < 10; ++i)
+    {
+        for (size_t j = 0; j < 10; ++j)
+        {
+            m[i][j] = i * 10 + j;
+        }
+    }
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre_matrix(m, ctx)),
+              "[[ 0, ...,  9],\n"
+              " ...,\n"
+              " [90, ..., 99]] (shape: 10 x 10)");
+}
+TEST(Matrix, Strided)
+{
+    std::vector<int> buf{1, 2, 0, 3, 4, 0, 5, 6, 0};
+    EXPECT_EQ(util::pre_str(util::pre_matrix(buf.data(), 3, 2, 3)),
+              "[[1, 2],\n [3, 4],\n [5, 6]]");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,94 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct Record
+{
+    int id;
+    std::vector<int> values;
+    std::string name;
+};
+
+TEST(Mem, Flat)
+{
+    int i = 0;
+    EXPECT_EQ(util::pre_mem(i).bytes(), sizeof(int));
+
+    std::vector<int> vec;
+    vec.reserve(100);
+    EXPECT_EQ(util::pre_mem(vec).bytes(), sizeof(vec) + 100 * sizeof(int));
+
+    std::array<int, 4> arr{};
+    EXPECT_EQ(util::pre_mem(arr).bytes(), sizeof(arr));
+}
+TEST(Mem, Strings)
+{
+    std::string small = "a";
+    EXPECT_EQ(util::pre_mem(small).bytes(), sizeof(small));
+    std::string large(1000, 'x');
+    EXPECT_EQ(util::pre_mem(large).bytes(),
+              sizeof(large) + large.capacity() + 1);
+    std::string_view view = large;
+    EXPECT_EQ(util::pre_mem(view).bytes(), sizeof(view));
+}
+TEST(Mem, Nested)
+{
+    std::vector<std::vector<int>> nested(3);
+    nested[0].reserve(10);
+    nested[2].reserve(20);
+    EXPECT_EQ(util::pre_mem(nested).bytes(),
+              sizeof(nested) + nested.capacity() * sizeof(nested[0]) +
+                  30 * sizeof(int));
+
+    std::map<int, std::string> m{{1, std::string(100, 'a')}};
+    EXPECT_GT(util::pre_mem(m).bytes(), sizeof(m) + 100);
+    std::unordered_map<int, int> um{{1, 1}, {2, 2}};
+    EXPECT_GE(util::pre_mem(um).bytes(),
+              sizeof(um) + um.bucket_count() * sizeof(void *));
+}
+TEST(Mem, Pointers)
+{
+    auto p = std::make_unique<std::vector<int>>(10);
+    EXPECT_EQ(util::pre_mem(p).bytes(),
+              sizeof(p) + sizeof(std::vector<int>) + 10 * sizeof(int));
+    std::shared_ptr<int> empty;
+    EXPECT_EQ(util::pre_mem(empty).bytes(), sizeof(empty));
+}
+TEST(Mem, Aggregate)
+{
+    Record r{1, std::vector<int>(4), std::string(64, 'r')};
+    size_t expected = sizeof(r) + r.values.capacity() * sizeof(int) +
+                      r.name.capacity() + 1;
+    EXPECT_EQ(util::pre_mem(r).bytes(), expected);
+
+    auto text = util::pre_str(util::pre_mem(r));
+    EXPECT_EQ(std::count(text.begin(), text.end(), '\n'), 3) << text;
+    EXPECT_NE(text.find("#1 "), std::string::npos);
+
+    util::pre_ctx ctx;
+    ctx.depth = 0;
+    text = util::pre_str(util::pre_mem(r, ctx));
+    EXPECT_EQ(text.find('\n'), std::string::npos);
+}
+TEST(Mem, Breakdown)
+{
+    std::vector<std::string> vec{std::string(100, 'a'), "b"};
+    auto text = util::pre_str(util::pre_mem(vec));
+    EXPECT_NE(text.find("elements: "), std::string::npos) << text;
+    EXPECT_NE(text.find(" in 2"), std::string::npos) << text;
+}
+TEST(Mem, Human)
+{
+    std::vector<char> vec;
+    vec.reserve(3 * 1024 * 1024);
+    util::pre_ctx ctx;
+    ctx.human = true;
+    ctx.depth = 0;
+    auto text = util::pre_str(util::pre_mem(vec, ctx));
+    EXPECT_NE(text.find("(heap 3.0 MiB)"), std::string::npos) << text;
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
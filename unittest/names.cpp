@@ -0,0 +1,32 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+TEST(Names, Single)
+{
+    int hei_you = 5;
+    EXPECT_EQ(util::pre_str(PRE(hei_you)), "hei_you: 5");
+}
+TEST(Names, Multiple)
+{
+    int a = 10;
+    float b = 5;
+    const char *name = "Bin";
+    std::vector<int> vec{1, 2, 3};
+    EXPECT_EQ(util::pre_str(PRES(a, b, name, vec)),
+              "a: 10, b: 5, name: Bin, vec: [1, 2, 3]");
+}
+TEST(Names, ManyArguments)
+{
+    int a0 = 0, a1 = 1, a2 = 2, a3 = 3, a4 = 4, a5 = 5, a6 = 6, a7 = 7,
+        a8 = 8, a9 = 9, a10 = 10, a11 = 11;
+    EXPECT_EQ(util::pre_str(PRES(a0, a1, a2, a3, a4, a5, a6, a7, a8, a9, a10,
+                                 a11)),
+              "a0: 0, a1: 1, a2: 2, a3: 3, a4: 4, a5: 5, a6: 6, a7: 7, a8: 8, "
+              "a9: 9, a10: 10, a11: 11");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,117 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct Point
+{
+    int x;
+    double y;
+    std::string name;
+};
+
+// print, parse back and print again
+template <typename T>
+void round_trip(const T &t)
+{
+    auto text = util::pre_str(t);
+    T back{};
+    EXPECT_TRUE(util::pre_parse(text, back)) << text;
+    EXPECT_EQ(util::pre_str(back), text);
+}
+
+TEST(Parse, Primitives)
+{
+    EXPECT_EQ(util::pre_parse<int>("-42"), -42);
+    EXPECT_EQ(util::pre_parse<double>("2.5"), 2.5);
+    EXPECT_EQ(util::pre_parse<bool>("true"), true);
+    EXPECT_EQ(util::pre_parse<char>("'x'"), 'x');
+    EXPECT_EQ(util::pre_parse<std::string>("\"a b\""), "a b");
+
+    std::string_view text = "\"view\"";
+    std::string_view sv;
+    EXPECT_TRUE(util::pre_parse(text, sv));
+    EXPECT_EQ(sv, "view");
+    EXPECT_EQ(sv.data(), text.data() + 1);
+}
+TEST(Parse, Delimiters)
+{
+    round_trip('\'');
+    round_trip(' ');
+    round_trip(std::vector<char>{'\'', ',', ']'});
+    EXPECT_EQ(util::pre_parse<char>("''"), std::nullopt);
+
+    EXPECT_EQ(util::pre_parse<std::vector<int>>("[1\t,\r\n2\t]"),
+              (std::vector<int>{1, 2}));
+    EXPECT_EQ(util::pre_parse<std::vector<double>>("[0.5\r, -1e-3\t]"),
+              (std::vector<double>{0.5, -1e-3}));
+    EXPECT_EQ(util::pre_parse<float>("1.5"), 1.5f);
+    EXPECT_EQ(util::pre_parse<double>("1.5x"), std::nullopt);
+    EXPECT_EQ(util::pre_parse<double>("1e999"), std::nullopt);
+}
+TEST(Parse, Containers)
+{
+    round_trip(std::vector<int>{1, -2, 3});
+    round_trip(std::vector<std::string>{"a", "b c"});
+    round_trip(std::map<std::string, std::vector<int>>{{"k", {1, 2}},
+                                                       {"l", {}}});
+    round_trip(std::set<int>{3, 1, 2});
+    round_trip(std::list<double>{1.5, 2.25});
+    round_trip(std::forward_list<int>{1, 2, 3});
+    round_trip(std::array<int, 3>{4, 5, 6});
+    round_trip(std::vector<bool>{true, false, true});
+    round_trip(std::bitset<10>(0b1000000101));
+}
+TEST(Parse, Wrappers)
+{
+    round_trip(std::pair<int, std::string>{1, "one"});
+    round_trip(std::tuple<int, char, bool>{1, 'c', false});
+    round_trip(std::optional<int>{7});
+    round_trip(std::optional<int>{});
+
+    std::atomic<int> a{0};
+    EXPECT_TRUE(util::pre_parse("atomic(5)", a));
+    EXPECT_EQ(a.load(), 5);
+}
+TEST(Parse, Aggregates)
+{
+    round_trip(Point{1, 2.5, "p"});
+    round_trip(std::vector<Point>{{1, 2, "a"}, {3, 4, "b"}});
+
+    Point p{};
+    EXPECT_TRUE(util::pre_parse("{Point <1, 2, \"a\">}", p));
+    EXPECT_EQ(p.name, "a");
+}
+TEST(Parse, InPlace)
+{
+    // the capacity of the target is reused
+    std::vector<int> vec;
+    vec.reserve(16);
+    auto data = vec.data();
+    EXPECT_TRUE(util::pre_parse("[1, 2, 3]", vec));
+    EXPECT_EQ(vec.data(), data);
+    EXPECT_EQ(vec, (std::vector<int>{1, 2, 3}));
+}
+TEST(Parse, Layout)
+{
+    util::pre_ctx ctx;
+    ctx.width = 10;
+    std::vector<std::vector<int>> m{{1, 2, 3}, {4, 5, 6}};
+    auto text = util::pre_str(util::pre(m, ctx));
+    EXPECT_NE(text.find('\n'), std::string::npos);
+    EXPECT_EQ(util::pre_parse<decltype(m)>(text), m);
+}
+TEST(Parse, Errors)
+{
+    EXPECT_FALSE(util::pre_parse<int>("1x"));
+    EXPECT_FALSE(util::pre_parse<std::vector<int>>("[1, ..., 3]"));
+    EXPECT_FALSE(util::pre_parse<std::vector<int>>("[1, 2"));
+    EXPECT_FALSE((util::pre_parse<std::array<int, 2>>("[1, 2, 3]")));
+    EXPECT_FALSE((util::pre_parse<std::array<int, 2>>("[1]")));
+    EXPECT_FALSE(util::pre_parse<std::string>("\"open"));
+    EXPECT_FALSE(util::pre_parse<int>("1 2"));
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
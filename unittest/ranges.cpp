@@ -0,0 +1,260 @@
+#include <memory_resource>
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+template <typename T>
+struct CountingAllocator : std::allocator<T>
+{
+    template <typename U>
+    struct rebind
+    {
+        using other = CountingAllocator<U>;
+    };
+    CountingAllocator() = default;
+    template <typename U>
+    CountingAllocator(const CountingAllocator<U> &)
+    {
+    }
+};
+
+struct IdentityHash
+{
+    size_t operator()(int i) const
+    {
+        return i;
+    }
+};
+
+// neither copyable nor printable through a container copy
+struct MoveOnly
+{
+    explicit MoveOnly(int v) : v(v)
+    {
+    }
+    MoveOnly(const MoveOnly &) = delete;
+    MoveOnly(MoveOnly &&) = default;
+    MoveOnly &operator=(MoveOnly &&) = default;
+    bool operator<(const MoveOnly &o) const
+    {
+        return v < o.v;
+    }
+    int v;
+};
+std::ostream &operator<<(std::ostream &os, const MoveOnly &m)
+{
+    return os << m.v;
+}
+
+// begin/end only, like many hand-written containers
+struct Range
+{
+    const int *begin() const
+    {
+        return data;
+    }
+    const int *end() const
+    {
+        return data + 3;
+    }
+    int data[3]{1, 2, 3};
+};
+
+// forward-only with size(), counting the iterator increments
+struct CountedRange
+{
+    struct iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int *;
+        using reference = const int &;
+
+        const int &operator*() const
+        {
+            return *p;
+        }
+        iterator &operator++()
+        {
+            ++p;
+            ++*steps;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const iterator &o) const
+        {
+            return p == o.p;
+        }
+        bool operator!=(const iterator &o) const
+        {
+            return p != o.p;
+        }
+        const int *p;
+        size_t *steps;
+    };
+    iterator begin() const
+    {
+        return {data.data(), &steps};
+    }
+    iterator end() const
+    {
+        return {data.data() + data.size(), &steps};
+    }
+    size_t size() const
+    {
+        return data.size();
+    }
+    std::vector<int> data;
+    mutable size_t steps = 0;
+};
+
+TEST(Ranges, CustomAllocator)
+{
+    std::vector<int, CountingAllocator<int>> vec{1, 2, 3};
+    EXPECT_EQ(util::pre_str(vec), "[1, 2, 3]");
+    std::pmr::vector<int> pmr{1, 2, 3};
+    EXPECT_EQ(util::pre_str(pmr), "[1, 2, 3]");
+}
+TEST(Ranges, CustomComparator)
+{
+    std::map<int, int, std::greater<int>> m{{1, 1}, {2, 2}};
+    EXPECT_EQ(util::pre_str(m), "{(2, 2), (1, 1)}");
+    std::set<int, std::greater<int>> s{1, 2, 3};
+    EXPECT_EQ(util::pre_str(s), "{3, 2, 1}");
+}
+TEST(Ranges, CustomHash)
+{
+    std::unordered_map<int, int, IdentityHash> m{{1, 1}};
+    EXPECT_EQ(util::pre_str(m), "{(1, 1)}");
+}
+TEST(Ranges, UserDefined)
+{
+    EXPECT_EQ(util::pre_str(Range{}), "[1, 2, 3]");
+    util::pre_ctx ctx;
+    ctx.limit = 1;
+    EXPECT_EQ(util::pre_str(util::pre(Range{}, ctx)), "[1, ...]");
+}
+TEST(Ranges, HeadAndTail)
+{
+    std::vector<int> vec{1, 2, 3, 4, 5};
+    EXPECT_EQ(util::pre_str(util::pre(vec, 2)), "[1, ..., 5]");
+    EXPECT_EQ(util::pre_str(util::pre(vec, 3)), "[1, 2, ..., 5]");
+
+    std::forward_list<int> fl{1, 2, 3, 4, 5, 6, 7};
+    EXPECT_EQ(util::pre_str(util::pre(fl, 4)), "[1, 2, ..., 6, 7]");
+    EXPECT_EQ(util::pre_str(util::pre(fl, 1)), "[1, ...]");
+    EXPECT_EQ(util::pre_str(util::pre(fl, 6)), "[1, 2, 3, ..., 5, 6, 7]");
+
+    util::pre_ctx ctx;
+    ctx.human = true;
+    ctx.limit = 5;
+    EXPECT_EQ(util::pre_str(util::pre(fl, ctx)),
+              "[1, 2, 3, ..., 6, 7] (sz: 7, ommitted 2)");
+    ctx.limit = 0;
+    EXPECT_EQ(util::pre_str(util::pre(fl, ctx)), "[...] (sz: 7, ommitted 7)");
+    ctx.limit = 7;
+    EXPECT_EQ(util::pre_str(util::pre(fl, ctx)),
+              "[1, 2, 3, 4, 5, 6, 7] (sz: 7, ommitted 0)");
+
+    // sized, but forward only
+    std::unordered_set<int> s{1, 2, 3, 4, 5};
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre(s, ctx)).size(),
+              std::string("{1, ..., 5} (sz: 5, ommitted 3)").size());
+}
+TEST(Ranges, NoWalkWithoutTail)
+{
+    CountedRange r{std::vector<int>(1000, 7)};
+    util::pre_ctx ctx;
+    ctx.limit = 1;
+    EXPECT_EQ(util::pre_str(util::pre(r, ctx)), "[7, ...]");
+    EXPECT_LE(r.steps, 1u);
+
+    // the tail is only reachable by walking
+    r.steps = 0;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre(r, ctx)), "[7, ..., 7]");
+    EXPECT_EQ(r.steps, 1000u);
+}
+TEST(Ranges, StringView)
+{
+    std::string_view sv = "hello";
+    EXPECT_EQ(util::pre_str(sv), "\"hello\"");
+    std::vector<std::string_view> vec{"a", "b"};
+    EXPECT_EQ(util::pre_str(vec), "[\"a\", \"b\"]");
+}
+TEST(Ranges, Adaptors)
+{
+    std::queue<int, std::list<int>> q;
+    q.push(1);
+    q.push(2);
+    EXPECT_EQ(util::pre_str(q), "[1, 2]");
+}
+TEST(Ranges, PriorityQueue)
+{
+    std::priority_queue<int> q;
+    for (int i : {5, 1, 8, 3, 9, 2, 7})
+    {
+        q.push(i);
+    }
+    EXPECT_EQ(util::pre_str(q), "[9, 8, 7, 5, 3, 2, 1]");
+    EXPECT_EQ(util::pre_str(util::pre(q, 3)), "[9, 8, 7, ...]");
+    EXPECT_EQ(util::pre_str(util::pre(q, 3, 1, true)),
+              "[9, 8, 7, ...] (sz: 7, ommitted 4)");
+    EXPECT_EQ(util::pre_str(util::pre(q, 0)), "[...]");
+
+    std::priority_queue<int, std::deque<int>, std::greater<int>> min_q;
+    for (int i : {5, 1, 8, 3})
+    {
+        min_q.push(i);
+    }
+    EXPECT_EQ(util::pre_str(min_q), "[1, 3, 5, 8]");
+    EXPECT_EQ(util::pre_str(std::priority_queue<int>{}), "[]");
+}
+TEST(Ranges, PriorityQueueMoveOnly)
+{
+    std::priority_queue<MoveOnly> q;
+    for (int i : {2, 4, 1, 3})
+    {
+        q.emplace(i);
+    }
+    EXPECT_EQ(util::pre_str(util::pre(q, 2)), "[4, 3, ...]");
+}
+TEST(Ranges, Sorted)
+{
+    util::pre_ctx ctx;
+    ctx.sorted = true;
+    std::unordered_set<int> s{5, 1, 4, 2, 3};
+    EXPECT_EQ(util::pre_str(util::pre(s, ctx)), "{1, 2, 3, 4, 5}");
+    std::unordered_map<std::string, int> m{{"b", 2}, {"a", 1}};
+    EXPECT_EQ(util::pre_str(util::pre(m, ctx)), "{(\"a\", 1), (\"b\", 2)}");
+
+    ctx.limit = 2;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre(s, ctx)),
+              "{1, 2, ...} (sz: 5, ommitted 3)");
+
+    // large enough for the bounded heap
+    std::unordered_set<int> big;
+    for (int i = 1000; i > 0; --i)
+    {
+        big.insert(i * 7 % 1000);
+    }
+    ctx.limit = 3;
+    ctx.human = false;
+    EXPECT_EQ(util::pre_str(util::pre(big, ctx)), "{0, 1, 2, ...}");
+    ctx.limit = 0;
+    EXPECT_EQ(util::pre_str(util::pre(big, ctx)), "{...}");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,157 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+std::string read_all(int fd)
+{
+    std::string ret;
+    char buf[256];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+    {
+        ret.append(buf, n);
+    }
+    return ret;
+}
+
+template <typename Recorder>
+std::string dump(const Recorder &recorder)
+{
+    int fds[2];
+    EXPECT_EQ(pipe(fds), 0);
+    recorder.dump(fds[1]);
+    close(fds[1]);
+    auto ret = read_all(fds[0]);
+    close(fds[0]);
+    return ret;
+}
+
+TEST(Recorder, Ring)
+{
+    static util::flight_recorder<3> recorder;
+    EXPECT_EQ(dump(recorder), "");
+    for (int i = 0; i < 5; ++i)
+    {
+        util::pre_line(recorder, PRES(i));
+    }
+    EXPECT_EQ(recorder.count(), 5);
+    EXPECT_EQ(dump(recorder), "i: 2\ni: 3\ni: 4\n");
+}
+TEST(Recorder, Truncate)
+{
+    static util::flight_recorder<2, 8> recorder;
+    std::vector<int> vec{1, 2, 3, 4, 5};
+    util::pre_line(recorder, vec);
+    EXPECT_EQ(dump(recorder), "[1, 2, \n");
+}
+TEST(Recorder, Threads)
+{
+    static util::flight_recorder<64> recorder;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back(
+            [t]()
+            {
+                for (int i = 0; i < 1000; ++i)
+                {
+                    util::pre_line(recorder, PRES(t, i));
+                }
+            });
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    EXPECT_EQ(recorder.count(), 4000);
+    auto text = dump(recorder);
+    EXPECT_EQ(std::count(text.begin(), text.end(), '\n'), 64);
+    EXPECT_NE(text.find("i: 999\n"), std::string::npos);
+}
+// Every record is one character repeated, so a torn one mixes two
+bool uniform_records(const std::string &text)
+{
+    for (size_t pos = 0; pos < text.size();)
+    {
+        size_t end = text.find('\n', pos);
+        if (end == std::string::npos ||
+            text.find_first_not_of(text[pos], pos) != end)
+        {
+            return false;
+        }
+        pos = end + 1;
+    }
+    return true;
+}
+TEST(Recorder, NotTorn)
+{
+    static util::flight_recorder<2, 65536> recorder;
+    std::atomic<int> running{6};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 6; ++t)
+    {
+        threads.emplace_back(
+            [t, &running]()
+            {
+                std::string line(60000, 'a' + t);
+                line.back() = '\n';
+                for (int i = 0; i < 2000; ++i)
+                {
+                    recorder.append(line.data(), line.size());
+                }
+                --running;
+            });
+    }
+    FILE *file = tmpfile();
+    ASSERT_NE(file, nullptr);
+    int fd = fileno(file);
+    size_t dumps = 0;
+    for (; running > 0 || dumps == 0; ++dumps)
+    {
+        ASSERT_EQ(ftruncate(fd, 0), 0);
+        ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+        recorder.dump(fd);
+        ASSERT_EQ(lseek(fd, 0, SEEK_SET), 0);
+        auto text = read_all(fd);
+        ASSERT_TRUE(uniform_records(text)) << "dump #" << dumps;
+    }
+    for (auto &t : threads)
+    {
+        t.join();
+    }
+    fclose(file);
+    EXPECT_GT(dumps, 0);
+}
+TEST(Recorder, Crash)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    pid_t pid = fork();
+    ASSERT_GE(pid, 0);
+    if (pid == 0)
+    {
+        static util::flight_recorder<4> recorder;
+        recorder.dump_on_crash(fds[1]);
+        util::pre_line(recorder, "last words");
+        abort();
+    }
+    close(fds[1]);
+    EXPECT_EQ(read_all(fds[0]), "last words\n");
+    close(fds[0]);
+    int status = 0;
+    waitpid(pid, &status, 0);
+    EXPECT_TRUE(WIFSIGNALED(status));
+    EXPECT_EQ(WTERMSIG(status), SIGABRT);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
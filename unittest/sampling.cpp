@@ -0,0 +1,62 @@
+#include <sstream>
+#include <thread>
+
+std::stringstream &test_sink()
+{
+    static std::stringstream ss;
+    return ss;
+}
+#define UP_LOG_SINK test_sink()
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+std::string take_sink()
+{
+    auto ret = test_sink().str();
+    test_sink().str("");
+    return ret;
+}
+
+TEST(Sampling, EveryN)
+{
+    int evaluated = 0;
+    for (int i = 0; i < 10; ++i)
+    {
+        PRE_EVERY_N(4, i, ++evaluated);
+    }
+    EXPECT_EQ(take_sink(),
+              "i: 0, ++evaluated: 1\ni: 4, ++evaluated: 2\ni: 8, "
+              "++evaluated: 3\n");
+    EXPECT_EQ(evaluated, 3);
+}
+TEST(Sampling, FirstN)
+{
+    int evaluated = 0;
+    for (int i = 0; i < 10; ++i)
+    {
+        PRE_FIRST_N(2, i, ++evaluated);
+    }
+    EXPECT_EQ(take_sink(), "i: 0, ++evaluated: 1\ni: 1, ++evaluated: 2\n");
+    EXPECT_EQ(evaluated, 2);
+}
+TEST(Sampling, EveryMs)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        PRE_EVERY_MS(1000 * 1000, i);
+    }
+    EXPECT_EQ(take_sink(), "i: 0\n");
+    for (int i = 0; i < 2; ++i)
+    {
+        PRE_EVERY_MS(1, i);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+    EXPECT_EQ(take_sink(), "i: 0\ni: 1\n");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,90 @@
+#include <csignal>
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct State
+{
+    int id;
+    std::string name;
+    std::vector<double> values;
+};
+
+template <typename T>
+std::string sigsafe(const T &t, size_t cap = 256, const util::pre_ctx &ctx = {})
+{
+    char buf[256];
+    return std::string(buf, util::pre_sigsafe(buf, cap, t, ctx));
+}
+
+TEST(SigSafe, Leaves)
+{
+    EXPECT_EQ(sigsafe(-42), "-42");
+    EXPECT_EQ(sigsafe(2.5), "2.5");
+    EXPECT_EQ(sigsafe(true), "true");
+    EXPECT_EQ(sigsafe('c'), "'c'");
+    EXPECT_EQ(sigsafe("abc"), "\"abc\"");
+    const char *null = nullptr;
+    EXPECT_EQ(sigsafe(null), "\"\"");
+    EXPECT_EQ(sigsafe(std::string("s")), "\"s\"");
+}
+TEST(SigSafe, Floats)
+{
+    for (double d : {0.0, -0.0, 1.0, -2.5, 0.1, 1.0 / 3, 123456.0, 1234567.0,
+                     999999.5, 0.0001, 0.00001234, 1e100, -1.5e-300, 5e-324,
+                     std::numeric_limits<double>::infinity(),
+                     -std::numeric_limits<double>::infinity()})
+    {
+        EXPECT_EQ(sigsafe(d), util::pre_str(d));
+    }
+    EXPECT_EQ(sigsafe(0.25f), util::pre_str(0.25f));
+    EXPECT_EQ(sigsafe(std::nan("")), "nan");
+    EXPECT_EQ(sigsafe(1.5, 2), "");
+}
+TEST(SigSafe, SameAsPre)
+{
+    std::vector<int> vec{1, 2, 3};
+    EXPECT_EQ(sigsafe(vec), util::pre_str(vec));
+    std::map<int, std::string> m{{1, "a"}, {2, "b"}};
+    EXPECT_EQ(sigsafe(m), util::pre_str(m));
+    auto tup = std::make_tuple(1, 'c', std::string("s"));
+    EXPECT_EQ(sigsafe(tup), util::pre_str(tup));
+    std::optional<int> opt{1};
+    EXPECT_EQ(sigsafe(opt), util::pre_str(opt));
+    State s{1, "n", {0.5}};
+    EXPECT_EQ(sigsafe(s), util::pre_str(s));
+}
+TEST(SigSafe, Bounded)
+{
+    std::vector<int> vec{1, 2, 3, 4, 5};
+    EXPECT_EQ(sigsafe(vec, 6), "[1, 2,");
+    EXPECT_EQ(sigsafe(123456, 3), "");
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    EXPECT_EQ(sigsafe(vec, 256, ctx), "[1, 2, ...]");
+}
+
+char handler_buf[256];
+size_t handler_len = 0;
+std::vector<int> *handler_state = nullptr;
+
+TEST(SigSafe, Handler)
+{
+    std::vector<int> state{7, 8, 9};
+    handler_state = &state;
+    auto old = signal(SIGUSR1,
+                      [](int)
+                      {
+                          handler_len = util::pre_sigsafe(
+                              handler_buf, sizeof(handler_buf), *handler_state);
+                      });
+    raise(SIGUSR1);
+    signal(SIGUSR1, old);
+    EXPECT_EQ(std::string(handler_buf, handler_len), "[7, 8, 9]");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,212 @@
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <csignal>
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+std::string read_all(int fd)
+{
+    std::string ret;
+    char buf[256];
+    ssize_t n;
+    while ((n = ::read(fd, buf, sizeof(buf))) > 0)
+    {
+        ret.append(buf, n);
+    }
+    return ret;
+}
+
+TEST(Line, Stream)
+{
+    std::stringstream ss;
+    std::vector<int> vec{1, 2, 3};
+    util::pre_line(ss, "vec: ", vec, ", ok: ", true);
+    EXPECT_EQ(ss.str(), "vec: [1, 2, 3], ok: true\n");
+}
+TEST(Line, Fd)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    int a = 1;
+    std::string s = "s";
+    util::pre_line(fds[1], PRES(a, s));
+    util::pre_line(fds[1], std::make_pair(1, 2));
+    close(fds[1]);
+    EXPECT_EQ(read_all(fds[0]), "a: 1, s: \"s\"\n(1, 2)\n");
+    close(fds[0]);
+}
+TEST(Line, EmitThrows)
+{
+    // one emit type, so that all calls share the thread-local buffer
+    bool fail = false;
+    const char *seen = nullptr;
+    auto emit = [&](const char *data, size_t)
+    {
+        seen = data;
+        if (fail)
+        {
+            throw std::runtime_error("emit");
+        }
+    };
+    util::pre_line_impl(emit, 1);
+    const char *first = seen;
+    fail = true;
+    EXPECT_THROW(util::pre_line_impl(emit, 2), std::runtime_error);
+    // still formatted into the thread-local buffer, not a re-entrant one
+    fail = false;
+    util::pre_line_impl(emit, 3);
+    EXPECT_EQ(seen, first);
+}
+TEST(Sink, Fd)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    {
+        // smaller than the output, so it flushes on the way
+        util::fd_sink sink(fds[1], 8);
+        std::vector<int> vec{1, 2, 3, 4, 5};
+        sink.os() << util::pre(vec) << '\n' << util::pre(std::string(20, 'x'));
+        util::pre_line(sink, "a: ", 1);
+    }
+    close(fds[1]);
+    EXPECT_EQ(read_all(fds[0]),
+              "[1, 2, 3, 4, 5]\n\"" + std::string(20, 'x') + "\"a: 1\n");
+    close(fds[0]);
+}
+TEST(Sink, Gather)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<std::string> docs{"ab", std::string(16, 'x'), "cd"};
+    std::string expected = util::pre_str(docs);
+    {
+        util::fd_sink sink(fds[1], 64, 16);
+        sink.os() << util::pre(docs);
+        // referenced, not copied: the change shows up at flush
+        docs[1].assign(16, 'y');
+        sink.os() << std::flush;
+    }
+    close(fds[1]);
+    std::replace(expected.begin(), expected.end(), 'x', 'y');
+    EXPECT_EQ(read_all(fds[0]), expected);
+    close(fds[0]);
+
+    // more strings than one writev batch, mixed with buffer flushes
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<std::string> many(200, std::string(32, 'z'));
+    {
+        util::fd_sink sink(fds[1], 8, 32);
+        sink.os() << util::pre(many);
+    }
+    close(fds[1]);
+    EXPECT_EQ(read_all(fds[0]), util::pre_str(many));
+    close(fds[0]);
+
+    // laid out streams copy, so strings stay between their brackets
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<std::string> wide{std::string(12, 'a'), std::string(16, 'b'),
+                                  "cc"};
+    util::pre_ctx ctx;
+    ctx.width = 10;
+    {
+        util::fd_sink sink(fds[1], 64, 4);
+        sink.os() << util::pre(wide, ctx);
+    }
+    close(fds[1]);
+    EXPECT_EQ(read_all(fds[0]),
+              "[\n    \"aaaaaaaaaaaa\",\n    \"bbbbbbbbbbbbbbbb\",\n"
+              "    \"cc\"\n]");
+    close(fds[0]);
+
+    // plain streams copy as usual
+    std::ostringstream os;
+    os << util::pre(std::string_view("abc"));
+    EXPECT_EQ(os.str(), "\"abc\"");
+}
+TEST(Sink, Mmap)
+{
+    char path[] = "/tmp/up_mmap_sinkXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    std::vector<int> vec(1000, 7);
+    {
+        // grows several times
+        util::mmap_sink sink(path, 16);
+        ASSERT_TRUE(sink.ok());
+        sink.os() << util::pre(vec);
+        util::pre_line(sink, "");
+        EXPECT_EQ(sink.size(), util::pre_str(vec).size() + 1);
+    }
+    fd = open(path, O_RDONLY);
+    EXPECT_EQ(read_all(fd), util::pre_str(vec) + "\n");
+    close(fd);
+    unlink(path);
+
+    util::mmap_sink bad("/nonexistent/dir/file");
+    EXPECT_FALSE(bad.ok());
+    bad.os() << util::pre(vec);
+    EXPECT_TRUE(bad.os().bad());
+}
+TEST(Sink, MmapGrowFails)
+{
+    char path[] = "/tmp/up_mmap_sinkXXXXXX";
+    int fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    close(fd);
+    // the file cannot grow past 64 KiB, ftruncate fails with EFBIG
+    struct rlimit saved;
+    ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &saved), 0);
+    struct rlimit limit = saved;
+    limit.rlim_cur = 1 << 16;
+    auto old_handler = signal(SIGXFSZ, SIG_IGN);
+    ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limit), 0);
+    std::string first(30000, 'a');
+    {
+        util::mmap_sink sink(path, 16);
+        sink.os() << first;
+        EXPECT_EQ(sink.size(), first.size());
+        sink.os() << std::string(40000, 'b');
+        EXPECT_TRUE(sink.os().bad());
+        EXPECT_EQ(sink.size(), first.size());
+        EXPECT_TRUE(sink.ok());
+    }
+    setrlimit(RLIMIT_FSIZE, &saved);
+    signal(SIGXFSZ, old_handler);
+    fd = open(path, O_RDONLY);
+    EXPECT_EQ(read_all(fd), first);
+    close(fd);
+
+    // the file can grow, but its mapping cannot
+    std::string big(64 << 20, 'c');
+    ASSERT_EQ(getrlimit(RLIMIT_AS, &saved), 0);
+    FILE *statm = fopen("/proc/self/statm", "r");
+    ASSERT_NE(statm, nullptr);
+    unsigned long pages = 0;
+    ASSERT_EQ(fscanf(statm, "%lu", &pages), 1);
+    fclose(statm);
+    limit = saved;
+    limit.rlim_cur = pages * sysconf(_SC_PAGESIZE) + (16 << 20);
+    {
+        util::mmap_sink sink(path, 16);
+        sink.os() << first;
+        ASSERT_EQ(setrlimit(RLIMIT_AS, &limit), 0);
+        sink.os() << big;
+        setrlimit(RLIMIT_AS, &saved);
+        EXPECT_TRUE(sink.os().bad());
+        EXPECT_EQ(sink.size(), first.size());
+    }
+    fd = open(path, O_RDONLY);
+    EXPECT_EQ(read_all(fd), first);
+    close(fd);
+    unlink(path);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,167 @@
+#define UP_STATS
+
+#include <unistd.h>
+
+#include <iomanip>
+#include <sstream>
+
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+// expr, noting its line in line
+#define AT_LINE(line, expr) ((line) = __LINE__, (expr))
+
+const util::stats::site *find_site(int line)
+{
+    auto suffix = "stats.cpp:" + std::to_string(line);
+    for (auto *s = util::stats::site::sites().load(); s; s = s->next)
+    {
+        std::string where = s->where;
+        if (where.size() >= suffix.size() &&
+            where.compare(where.size() - suffix.size(), suffix.size(),
+                          suffix) == 0)
+        {
+            return s;
+        }
+    }
+    return nullptr;
+}
+
+TEST(Stats, Site)
+{
+    std::vector<int> vec{1, 2, 3};
+    int a = 7;
+    std::stringstream ss;
+    int loop_line = 0;
+    int once_line = 0;
+    for (int i = 0; i < 3; ++i)
+    {
+        // the same line is the same site
+        ss << AT_LINE(loop_line, PRE(vec)) << PRES(a);
+    }
+    ss << AT_LINE(once_line, PRE_SITE(util::pre(vec)));
+    EXPECT_EQ(ss.str(),
+              "vec: [1, 2, 3]a: 7vec: [1, 2, 3]a: 7vec: [1, 2, 3]a: 7"
+              "[1, 2, 3]");
+
+    // PRE and PRES of the loop above share their line
+    auto *loop = find_site(loop_line);
+    ASSERT_NE(loop, nullptr);
+    EXPECT_EQ(loop->calls.load(), 3);
+    EXPECT_STREQ(loop->next->where, loop->where);
+    EXPECT_EQ(loop->calls.load() + loop->next->calls.load(), 6);
+    EXPECT_EQ(loop->bytes.load() + loop->next->bytes.load(), 3 * (14 + 4));
+    EXPECT_EQ(loop->elements.load() + loop->next->elements.load(), 3 * 3);
+
+    auto *once = find_site(once_line);
+    ASSERT_NE(once, nullptr);
+    EXPECT_EQ(once->calls.load(), 1);
+    EXPECT_EQ(once->bytes.load(), 9);
+    EXPECT_EQ(once->elements.load(), 3);
+}
+TEST(Stats, Line)
+{
+    std::stringstream ss;
+    std::vector<std::string> names{"a", "b"};
+    int line = 0;
+    util::pre_line(ss, AT_LINE(line, PRES(names)));
+    EXPECT_EQ(ss.str(), "names: [\"a\", \"b\"]\n");
+    auto *s = find_site(line);
+    ASSERT_NE(s, nullptr);
+    EXPECT_EQ(s->bytes.load(), 17);
+    EXPECT_EQ(s->elements.load(), 2);
+}
+TEST(Stats, Dump)
+{
+    std::stringstream ss;
+    int line = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        ss << AT_LINE(line, PRE(i));
+    }
+    std::stringstream dump;
+    util::pre_stats_dump(dump, 2);
+    auto text = dump.str();
+    EXPECT_EQ(std::count(text.begin(), text.end(), '\n'), 2);
+    EXPECT_NE(text.find("stats.cpp:"), std::string::npos);
+    EXPECT_NE(text.find(" calls: "), std::string::npos);
+    EXPECT_NE(text.find(", ns: "), std::string::npos);
+
+    util::pre_stats_dump(dump, 100);
+    auto expected = "stats.cpp:" + std::to_string(line) +
+                    " calls: 2, bytes: 8, elements: 0";
+    EXPECT_NE(dump.str().find(expected), std::string::npos);
+}
+// Prints v with PRE_SITE or without, as part of an enclosing layout
+class Nested
+{
+public:
+    Nested(std::vector<int> v, bool site) : v_(std::move(v)), site_(site)
+    {
+    }
+    friend std::ostream &operator<<(std::ostream &os, const Nested &n)
+    {
+        util::pre_ctx ctx;
+        ctx.width = 10;
+        if (n.site_)
+        {
+            return os << PRE_SITE(util::pre(n.v_, ctx));
+        }
+        return os << util::pre(n.v_, ctx);
+    }
+
+private:
+    std::vector<int> v_;
+    bool site_;
+};
+
+TEST(Stats, Format)
+{
+    std::stringstream ss;
+    int line = 0;
+    ss << std::hex << AT_LINE(line, PRE(255));
+    EXPECT_EQ(ss.str(), "255: ff");
+    EXPECT_EQ(find_site(line)->bytes.load(), 7);
+    ss.str("");
+    ss << std::setw(6) << AT_LINE(line, PRE_SITE(util::pre(1))) << 2;
+    EXPECT_EQ(ss.str(), "     12");
+
+    util::pre_ctx ctx;
+    ctx.width = 10;
+    std::vector<int> vec{1, 2, 3, 4, 5};
+    auto plain = util::pre_str(
+        util::pre(std::vector<Nested>{{vec, false}}, ctx));
+    EXPECT_NE(plain.find('\n'), std::string::npos);
+    EXPECT_EQ(util::pre_str(util::pre(
+                  std::vector<Nested>{{vec, true}}, ctx)), plain);
+}
+TEST(Stats, Gather)
+{
+    int fds[2];
+    ASSERT_EQ(pipe(fds), 0);
+    std::vector<std::string> docs{std::string(100, 'x')};
+    int line = 0;
+    {
+        util::fd_sink sink(fds[1], 1 << 16, 16);
+        sink.os() << AT_LINE(line, PRE(docs));
+        // gathered strings are referenced until the flush
+        docs[0][0] = 'y';
+        sink.os() << std::flush;
+    }
+    close(fds[1]);
+    std::string text;
+    char buf[256];
+    for (ssize_t n; (n = read(fds[0], buf, sizeof(buf))) > 0;)
+    {
+        text.append(buf, n);
+    }
+    close(fds[0]);
+    EXPECT_EQ(text, "docs: [\"y" + std::string(99, 'x') + "\"]");
+    EXPECT_EQ(find_site(line)->bytes.load(), text.size());
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
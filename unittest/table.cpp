@@ -0,0 +1,66 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+struct Person
+{
+    std::string name;
+    int age;
+};
+
+TEST(Table, Aggregate)
+{
+    std::vector<Person> persons{{"Alice", 20}, {"Bob", 100}};
+    EXPECT_EQ(util::pre_str(util::pre_table(persons)),
+              "Person\n"
+              "# | 0       | 1\n"
+              "0 | \"Alice\" | 20\n"
+              "1 | \"Bob\"   | 100");
+}
+TEST(Table, Tuple)
+{
+    std::vector<std::tuple<int, std::vector<int>>> vec{{1, {1, 2}},
+                                                       {10, {}}};
+    auto str = util::pre_str(util::pre_table(vec));
+    // skip the type name, which is compiler-specific
+    EXPECT_EQ(str.substr(str.find('\n') + 1),
+              "# | 0  | 1\n"
+              "0 | 1  | [1, 2]\n"
+              "1 | 10 | []");
+}
+TEST(Table, Limit)
+{
+    std::vector<std::pair<int, int>> vec;
+    for (int i = 0; i < 100; ++i)
+    {
+        vec.emplace_back(i, i * i);
+    }
+    util::pre_ctx ctx;
+    ctx.limit = 3;
+    ctx.human = true;
+    auto str = util::pre_str(util::pre_table(vec, ctx));
+    EXPECT_NE(str.find(" (sz: 100, ommitted 97)\n"), std::string::npos);
+    EXPECT_EQ(str.substr(str.find('\n') + 1),
+              "  # | 0   | 1\n"
+              "  0 | 0   | 0\n"
+              "  1 | 1   | 1\n"
+              "... | ... | ...\n"
+              " 99 | 99  | 9801");
+}
+TEST(Table, Sample)
+{
+    std::vector<std::pair<int, int>> vec;
+    for (int i = 0; i < 100; ++i)
+    {
+        vec.emplace_back(i, 0);
+    }
+    auto str = util::pre_str(util::pre_table(vec));
+    // widths are decided by the first rows
+    EXPECT_NE(str.find("\n 9 | 9  | 0\n"), std::string::npos);
+    EXPECT_NE(str.find("\n99 | 99 | 0"), std::string::npos);
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
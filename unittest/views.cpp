@@ -0,0 +1,196 @@
+#include "gtest/gtest.h"
+#include "up/pre.hpp"
+
+// forward-only with size(), like unordered_map, counting the increments
+struct CountedRange
+{
+    struct iterator
+    {
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = int;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const int *;
+        using reference = const int &;
+
+        const int &operator*() const
+        {
+            return *p;
+        }
+        iterator &operator++()
+        {
+            ++p;
+            ++*steps;
+            return *this;
+        }
+        iterator operator++(int)
+        {
+            auto ret = *this;
+            ++*this;
+            return ret;
+        }
+        bool operator==(const iterator &o) const
+        {
+            return p == o.p;
+        }
+        bool operator!=(const iterator &o) const
+        {
+            return p != o.p;
+        }
+        const int *p;
+        size_t *steps;
+    };
+    iterator begin() const
+    {
+        return {data.data(), &steps};
+    }
+    iterator end() const
+    {
+        return {data.data() + data.size(), &steps};
+    }
+    size_t size() const
+    {
+        return data.size();
+    }
+    std::vector<int> data;
+    mutable size_t steps = 0;
+};
+
+TEST(Views, Filter)
+{
+    std::vector<int> vec{1, 2, 3, 4, 5, 6};
+    auto even = [](int i) { return i % 2 == 0; };
+    EXPECT_EQ(util::pre_str(util::pre_filter(vec, even)), "[2, 4, 6]");
+
+    std::map<int, std::string> m{{1, "a"}, {2, "b"}, {3, "c"}};
+    auto odd_key = [](const auto &kv) { return kv.first % 2; };
+    EXPECT_EQ(util::pre_str(util::pre_filter(m, odd_key)),
+              "[(1, \"a\"), (3, \"c\")]");
+    EXPECT_EQ(util::pre_str(util::pre_filter(vec, [](int) { return false; })),
+              "[]");
+}
+TEST(Views, FilterStopsAtLimit)
+{
+    std::vector<int> vec{1, 2, 3, 4, 5, 6};
+    size_t calls = 0;
+    auto counted = [&](int) { return ++calls, true; };
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre_filter(vec, counted, ctx)),
+              "[1, 2, ...]");
+    EXPECT_EQ(calls, 3);
+
+    ctx.human = true;
+    auto even = [](int i) { return i % 2 == 0; };
+    EXPECT_EQ(util::pre_str(util::pre_filter(vec, even, ctx)),
+              "[2, 4, ...] (sz: 3, ommitted 1)");
+}
+TEST(Views, Transform)
+{
+    std::vector<int> vec{1, 2, 3, 4, 5};
+    auto square = [](int i) { return i * i; };
+    EXPECT_EQ(util::pre_str(util::pre_transform(vec, square)),
+              "[1, 4, 9, 16, 25]");
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre_transform(vec, square, ctx)),
+              "[1, ..., 25]");
+
+    std::forward_list<int> fl{1, 2, 3};
+    EXPECT_EQ(util::pre_str(util::pre_transform(fl, square, ctx)),
+              "[1, 4, ...]");
+}
+TEST(Views, TransformStopsAtLimit)
+{
+    CountedRange r{std::vector<int>(1000, 3)};
+    auto twice = [](int i) { return 2 * i; };
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre_transform(r, twice, ctx)),
+              "[6, 6, ...]");
+    EXPECT_LE(r.steps, 2u);
+
+    r.steps = 0;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre_transform(r, twice, ctx)),
+              "[6, 6, ...] (sz: 1000, ommitted 998)");
+    EXPECT_LE(r.steps, 2u);
+}
+TEST(Views, KeysAndValues)
+{
+    std::map<std::string, int> m{{"a", 1}, {"b", 2}, {"c", 3}};
+    EXPECT_EQ(util::pre_str(util::pre_keys(m)), "[\"a\", \"b\", \"c\"]");
+    EXPECT_EQ(util::pre_str(util::pre_values(m)), "[1, 2, 3]");
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre_keys(m, ctx)),
+              "[\"a\", ..., \"c\"] (sz: 3, ommitted 1)");
+
+    std::unordered_map<int, std::vector<int>> um{{1, {1, 2}}};
+    EXPECT_EQ(util::pre_str(util::pre_values(um)), "[[1, 2]]");
+}
+TEST(Views, Range)
+{
+    std::map<int, char> m;
+    for (int i = 0; i < 100; ++i)
+    {
+        m[i * 10] = 'a' + i % 26;
+    }
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 195, 230)),
+              "{(200, 'u'), (210, 'v'), (220, 'w')}");
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 300, 300)), "{}");
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 2000, 3000)), "{}");
+
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    ctx.human = true;
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 0, 50, ctx)),
+              "{(0, 'a'), ..., (40, 'e')} (sz: 5, ommitted 3)");
+
+    std::multiset<int> ms{1, 2, 2, 2, 3};
+    EXPECT_EQ(util::pre_str(util::pre_range(ms, 2, 3)), "{2, 2, 2}");
+
+    std::vector<int> sorted{1, 3, 5, 7, 9, 11};
+    EXPECT_EQ(util::pre_str(util::pre_range(sorted, 4, 10)), "[5, 7, 9]");
+    EXPECT_EQ(util::pre_str(util::pre_range(sorted, 10, 4)), "[]");
+}
+TEST(Views, RangeDescending)
+{
+    std::map<int, int, std::greater<int>> m;
+    for (int i = 0; i < 100; i += 10)
+    {
+        m[i] = i;
+    }
+    // [lo, hi) in the order of the map
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 60, 20)),
+              "{(60, 60), (50, 50), (40, 40), (30, 30)}");
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 20, 60)), "{}");
+    EXPECT_EQ(util::pre_str(util::pre_around(m, 45, 1)),
+              "{(50, 50), (40, 40), (30, 30)}");
+
+    util::pre_ctx ctx;
+    ctx.limit = 2;
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 90, 0, ctx)),
+              "{(90, 90), ..., (10, 10)}");
+    ctx.limit = 5;
+    EXPECT_EQ(util::pre_str(util::pre_range(m, 50, 0, ctx)),
+              "{(50, 50), (40, 40), (30, 30), (20, 20), (10, 10)}");
+}
+TEST(Views, Around)
+{
+    std::set<int> s{10, 20, 30, 40, 50, 60};
+    EXPECT_EQ(util::pre_str(util::pre_around(s, 35, 1)), "{30, 40, 50}");
+    EXPECT_EQ(util::pre_str(util::pre_around(s, 40, 2)),
+              "{20, 30, 40, 50, 60}");
+    EXPECT_EQ(util::pre_str(util::pre_around(s, 10, 1)), "{10, 20}");
+    EXPECT_EQ(util::pre_str(util::pre_around(s, 100, 1)), "{60}");
+
+    std::vector<int> sorted{1, 3, 5, 7, 9};
+    EXPECT_EQ(util::pre_str(util::pre_around(sorted, 5, 1)), "[3, 5, 7]");
+}
+
+int main(int argc, char **argv)
+{
+    ::testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}